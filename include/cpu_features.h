@@ -0,0 +1,79 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// Instruction set levels SIMD kernels are built for. Each level includes the ones before it,
+// IsaBaseline is whatever the compiler targets without extra flags (SSE2 on x86-64).
+enum SimdIsa {
+    IsaBaseline,
+    IsaAVX2,
+    IsaAVX512,
+};
+
+// Highest level this CPU and operating system support, from CPUID and XGETBV. Checked once.
+SimdIsa cpu_isa();
+
+// One copy of a kernel table (RayKernels, RasterKernels) and the level it was compiled for. Each
+// dispatcher lists the copies in its build, lowest level first, and picks from them with the
+// functions below. best_fits(table) says whether a copy may be picked as "best": the last copy
+// this CPU runs that fits wins, the first one if none does.
+template <typename Table>
+struct KernelVariant {
+    SimdIsa isa;
+    const Table* table;
+};
+
+// Copy compiled for isa ("best" or a table's isa name) that this CPU can run, or nullptr
+template <typename Table, int count, typename BestFits>
+const Table* find_kernel_variant(const KernelVariant<Table> (&variants)[count], const char* isa,
+                                 BestFits best_fits) {
+    bool best = std::strcmp(isa, "best") == 0;
+    const Table* found = nullptr;
+    for (int i = 0; i < count; i++) {
+        if (variants[i].isa > cpu_isa()) {
+            break;
+        }
+        if (best ? best_fits(*variants[i].table) || !found : std::strcmp(isa, variants[i].table->isa) == 0) {
+            found = variants[i].table;
+        }
+    }
+    return found;
+}
+
+// The copy the RENDER_ISA environment variable names, or the best one
+template <typename Table, int count, typename BestFits>
+Table startup_kernel_variant(const KernelVariant<Table> (&variants)[count], BestFits best_fits) {
+    const char* isa = std::getenv("RENDER_ISA");
+    const Table* table = isa ? find_kernel_variant(variants, isa, best_fits) : nullptr;
+    return table ? *table : *find_kernel_variant(variants, "best", best_fits);
+}
+
+// Copies the table for isa into kernels. Returns false and leaves kernels alone if there is none.
+template <typename Table, int count, typename BestFits>
+bool select_kernel_variant(const KernelVariant<Table> (&variants)[count], const char* isa, BestFits best_fits,
+                           Table& kernels) {
+    const Table* table = find_kernel_variant(variants, isa, best_fits);
+    if (!table) {
+        return false;
+    }
+    kernels = *table;
+    return true;
+}
+
+// Instruction sets of the copies, comma separated
+template <typename Table, int count>
+const char* kernel_variant_names(const KernelVariant<Table> (&variants)[count]) {
+    static const std::string names = [&] {
+        std::string joined;
+        for (int i = 0; i < count; i++) {
+            joined += (i > 0 ? "," : "") + std::string(variants[i].table->isa);
+        }
+        return joined;
+    }();
+    return names.c_str();
+}
+
+#endif // !CPU_FEATURES_H
@@ -0,0 +1,17 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include "render.h"
+
+#include <vector>
+#include <string>
+
+struct Mesh {
+    std::vector<Vec3> vertices;
+    std::vector<std::vector<int>> faces;
+};
+
+std::vector<std::string> split(const std::string& line, char delimiter=' ');
+Mesh load_mesh(const std::string& mesh_file);
+
+#endif // !MESH_H
@@ -16,82 +16,267 @@ struct Color {
     Color() {}
 };
 
-struct Vec3 {
-    double x, y, z;
-    Vec3(double x, double y, double z) : x(x), y(y), z(z) {}
-    Vec3() {}
+// Scalar type of the math types below. float by default, double when built with RENDER_DOUBLE
+// (the RENDER_DOUBLE_PRECISION CMake option) to validate results against.
+#ifdef RENDER_DOUBLE
+using real = double;
+#else
+using real = float;
+#endif
+
+// With float and SSE2 (x86) or NEON (AArch64), Vec3, Vec4 and Mat4 are 16 byte aligned (Vec3 has a
+// fourth component as padding) and the operators below are overloaded with 4-wide versions, which
+// load the components into a register, work on that and store the result. The few operations they
+// need per instruction set come first. Other configurations use the plain templates.
+#if !defined(RENDER_DOUBLE) && \
+    (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define RENDER_SSE 1
+#define RENDER_LANES 1
+#elif !defined(RENDER_DOUBLE) && (defined(__aarch64__) || defined(_M_ARM64))
+#include <arm_neon.h>
+#define RENDER_NEON 1
+#define RENDER_LANES 1
+#endif
+
+#ifdef RENDER_SSE
+using Lanes = __m128;
+static inline Lanes lanes_load(const float* pointer) { return _mm_load_ps(pointer); }
+static inline void lanes_store(float* pointer, Lanes lanes) { _mm_store_ps(pointer, lanes); }
+static inline Lanes lanes_set(float x, float y, float z, float w) { return _mm_setr_ps(x, y, z, w); }
+static inline Lanes lanes_splat(float value) { return _mm_set1_ps(value); }
+static inline Lanes lanes_add(Lanes left, Lanes right) { return _mm_add_ps(left, right); }
+static inline Lanes lanes_sub(Lanes left, Lanes right) { return _mm_sub_ps(left, right); }
+static inline Lanes lanes_mul(Lanes left, Lanes right) { return _mm_mul_ps(left, right); }
+static inline Lanes lanes_div(Lanes left, Lanes right) { return _mm_div_ps(left, right); }
+template <int lane>
+static inline Lanes lanes_broadcast(Lanes lanes) {
+    return _mm_shuffle_ps(lanes, lanes, _MM_SHUFFLE(lane, lane, lane, lane));
+}
+static inline void lanes_transpose(Lanes& row0, Lanes& row1, Lanes& row2, Lanes& row3) {
+    _MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+}
+
+// The first three lanes are equal
+static inline bool lanes_equal3(Lanes left, Lanes right) {
+    return (_mm_movemask_ps(_mm_cmpeq_ps(left, right)) & 7) == 7;
+}
+
+// x * x + y * y + z * z in lane 0, summed in the same order as the scalar version
+static inline __m128 lanes_dot3_ss(Lanes left, Lanes right) {
+    __m128 product = _mm_mul_ps(left, right);
+    __m128 sum = _mm_add_ss(product, lanes_broadcast<1>(product));
+    return _mm_add_ss(sum, _mm_movehl_ps(product, product));
+}
+
+static inline float lanes_dot3(Lanes left, Lanes right) { return _mm_cvtss_f32(lanes_dot3_ss(left, right)); }
+static inline float lanes_length3(Lanes lanes) { return _mm_cvtss_f32(_mm_sqrt_ss(lanes_dot3_ss(lanes, lanes))); }
+
+static inline Lanes lanes_cross3(Lanes left, Lanes right) {
+    // left * right.yzx - left.yzx * right gives the cross product in zxy order
+    __m128 left_yzx = _mm_shuffle_ps(left, left, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 right_yzx = _mm_shuffle_ps(right, right, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 zxy = _mm_sub_ps(_mm_mul_ps(left, right_yzx), _mm_mul_ps(left_yzx, right));
+    return _mm_shuffle_ps(zxy, zxy, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+// 1 / length in every lane: the rsqrt estimate (12 bits) refined by one Newton-Raphson step to
+// about 22 bits, which saves the square root and the division of the scalar version
+static inline Lanes lanes_inverse_length3(Lanes lanes) {
+    __m128 length2 = lanes_dot3_ss(lanes, lanes);
+    __m128 estimate = _mm_rsqrt_ss(length2);
+    __m128 half_length2 = _mm_mul_ss(_mm_set_ss(0.5f), length2);
+    __m128 refined = _mm_mul_ss(estimate, _mm_sub_ss(_mm_set_ss(1.5f),
+                                                     _mm_mul_ss(half_length2, _mm_mul_ss(estimate, estimate))));
+    return lanes_broadcast<0>(refined);
+}
+#endif
+
+#ifdef RENDER_NEON
+using Lanes = float32x4_t;
+static inline Lanes lanes_load(const float* pointer) { return vld1q_f32(pointer); }
+static inline void lanes_store(float* pointer, Lanes lanes) { vst1q_f32(pointer, lanes); }
+static inline Lanes lanes_set(float x, float y, float z, float w) {
+    const float values[4] = {x, y, z, w};
+    return vld1q_f32(values);
+}
+static inline Lanes lanes_splat(float value) { return vdupq_n_f32(value); }
+static inline Lanes lanes_add(Lanes left, Lanes right) { return vaddq_f32(left, right); }
+static inline Lanes lanes_sub(Lanes left, Lanes right) { return vsubq_f32(left, right); }
+static inline Lanes lanes_mul(Lanes left, Lanes right) { return vmulq_f32(left, right); }
+static inline Lanes lanes_div(Lanes left, Lanes right) { return vdivq_f32(left, right); }
+template <int lane>
+static inline Lanes lanes_broadcast(Lanes lanes) { return vdupq_laneq_f32(lanes, lane); }
+static inline void lanes_transpose(Lanes& row0, Lanes& row1, Lanes& row2, Lanes& row3) {
+    float32x4x2_t rows01 = vtrnq_f32(row0, row1); // x0 x1 z0 z1, y0 y1 w0 w1
+    float32x4x2_t rows23 = vtrnq_f32(row2, row3);
+    row0 = vcombine_f32(vget_low_f32(rows01.val[0]), vget_low_f32(rows23.val[0]));
+    row1 = vcombine_f32(vget_low_f32(rows01.val[1]), vget_low_f32(rows23.val[1]));
+    row2 = vcombine_f32(vget_high_f32(rows01.val[0]), vget_high_f32(rows23.val[0]));
+    row3 = vcombine_f32(vget_high_f32(rows01.val[1]), vget_high_f32(rows23.val[1]));
+}
+
+static inline bool lanes_equal3(Lanes left, Lanes right) {
+    uint32x4_t equal = vceqq_f32(left, right);
+    return (vgetq_lane_u32(equal, 0) & vgetq_lane_u32(equal, 1) & vgetq_lane_u32(equal, 2)) != 0;
+}
+
+static inline float lanes_dot3(Lanes left, Lanes right) {
+    Lanes product = vmulq_f32(left, right);
+    return vgetq_lane_f32(product, 0) + vgetq_lane_f32(product, 1) + vgetq_lane_f32(product, 2);
+}
+
+static inline float lanes_length3(Lanes lanes) {
+    return vget_lane_f32(vsqrt_f32(vdup_n_f32(lanes_dot3(lanes, lanes))), 0);
+}
+
+// NEON has no free lane shuffle, so this one goes lane by lane
+static inline Lanes lanes_cross3(Lanes left, Lanes right) {
+    float lx = vgetq_lane_f32(left, 0), ly = vgetq_lane_f32(left, 1), lz = vgetq_lane_f32(left, 2);
+    float rx = vgetq_lane_f32(right, 0), ry = vgetq_lane_f32(right, 1), rz = vgetq_lane_f32(right, 2);
+    return lanes_set(ly * rz - lz * ry, lz * rx - lx * rz, lx * ry - ly * rx, 0);
+}
+
+// Same as the SSE version, with NEON's estimate and step instructions
+static inline Lanes lanes_inverse_length3(Lanes lanes) {
+    Lanes length2 = vdupq_n_f32(lanes_dot3(lanes, lanes));
+    Lanes estimate = vrsqrteq_f32(length2);
+    return vmulq_f32(estimate, vrsqrtsq_f32(vmulq_f32(length2, estimate), estimate));
+}
+#endif
+
+// Keeps a scalar argument out of template deduction, so 0.5 * Vec3T<float> still compiles
+template <typename T>
+struct NonDeduced {
+    using type = T;
+};
+
+template <typename T>
+struct Vec3T {
+    T x, y, z;
+    Vec3T(T x, T y, T z) : x(x), y(y), z(z) {}
+    Vec3T() {}
 };
 
-static Vec3 operator+(const Vec3& left, const Vec3& right) {
-    return Vec3(left.x + right.x, left.y + right.y, left.z + right.z);
+#ifdef RENDER_LANES
+template <>
+struct alignas(16) Vec3T<float> {
+    float x, y, z;
+    float padding; // 0 from the constructors, never read as a component
+    Vec3T(float x, float y, float z) : x(x), y(y), z(z), padding(0) {}
+    Vec3T(Lanes lanes) { lanes_store(&x, lanes); }
+    Vec3T() {}
+    Lanes lanes() const { return lanes_load(&x); }
+};
+#endif
+
+using Vec3 = Vec3T<real>;
+
+template <typename T>
+static bool operator==(const Vec3T<T>& left, const Vec3T<T>& right) {
+    return left.x == right.x && left.y == right.y && left.z == right.z;
+}
+
+template <typename T>
+static Vec3T<T> operator+(const Vec3T<T>& left, const Vec3T<T>& right) {
+    return Vec3T<T>(left.x + right.x, left.y + right.y, left.z + right.z);
 }
 
-static Vec3 operator-(const Vec3& left, const Vec3& right) {
-    return Vec3(left.x - right.x, left.y - right.y, left.z - right.z);
+template <typename T>
+static Vec3T<T> operator-(const Vec3T<T>& left, const Vec3T<T>& right) {
+    return Vec3T<T>(left.x - right.x, left.y - right.y, left.z - right.z);
 }
 
-static Vec3 operator*(const Vec3& left, const Vec3& right) {
-    return Vec3(left.x * right.x, left.y * right.y, left.z * right.z);
+template <typename T>
+static Vec3T<T> operator*(const Vec3T<T>& left, const Vec3T<T>& right) {
+    return Vec3T<T>(left.x * right.x, left.y * right.y, left.z * right.z);
 }
 
-static Vec3 operator*(double scalar, const Vec3& vec) {
-    return Vec3(scalar * vec.x, scalar * vec.y, scalar * vec.z);
+template <typename T>
+static Vec3T<T> operator*(typename NonDeduced<T>::type scalar, const Vec3T<T>& vec) {
+    return Vec3T<T>(scalar * vec.x, scalar * vec.y, scalar * vec.z);
 }
 
-static Vec3 operator/(const Vec3& vec, double scalar) {
-    return Vec3(vec.x / scalar, vec.y / scalar, vec.z / scalar);
+template <typename T>
+static Vec3T<T> operator/(const Vec3T<T>& vec, typename NonDeduced<T>::type scalar) {
+    return Vec3T<T>(vec.x / scalar, vec.y / scalar, vec.z / scalar);
 }
 
-static double dot(const Vec3& left, const Vec3& right) {
+template <typename T>
+static T dot(const Vec3T<T>& left, const Vec3T<T>& right) {
     return left.x * right.x + left.y * right.y + left.z * right.z;
 }
 
-static Vec3 cross(const Vec3& left, const Vec3& right) {
-    return Vec3(
+template <typename T>
+static Vec3T<T> cross(const Vec3T<T>& left, const Vec3T<T>& right) {
+    return Vec3T<T>(
         left.y * right.z - left.z * right.y,
         left.z * right.x - left.x * right.z,
         left.x * right.y - left.y * right.x
     );
 }
 
-static double magnitude(const Vec3& vec) {
+template <typename T>
+static T magnitude(const Vec3T<T>& vec) {
     return std::sqrt(vec.x * vec.x + vec.y * vec.y + vec.z * vec.z);
 }
 
-static Vec3 normalize(const Vec3& vec) {
+template <typename T>
+static Vec3T<T> normalize(const Vec3T<T>& vec) {
     return vec / magnitude(vec);
 }
 
-struct Vec2 {
-    double x, y;
-    Vec2(double x, double y) : x(x), y(y) {}
-    Vec2() {}
+template <typename T>
+struct Vec2T {
+    T x, y;
+    Vec2T(T x, T y) : x(x), y(y) {}
+    Vec2T() {}
 };
 
-static Vec2 operator-(const Vec2 &left, const Vec2 &right) {
-    return Vec2(left.x - right.x, left.y - right.y);
+using Vec2 = Vec2T<real>;
+
+template <typename T>
+static Vec2T<T> operator-(const Vec2T<T> &left, const Vec2T<T> &right) {
+    return Vec2T<T>(left.x - right.x, left.y - right.y);
 }
 
-static Vec2 operator+(const Vec2 &left, const Vec2 &right) {
-    return Vec2(left.x + right.x, left.y + right.y);
+template <typename T>
+static Vec2T<T> operator+(const Vec2T<T> &left, const Vec2T<T> &right) {
+    return Vec2T<T>(left.x + right.x, left.y + right.y);
 }
 
-static Vec2 operator*(const Vec2 &left, double scalar) {
-    return Vec2(left.x * scalar, left.y * scalar);
+template <typename T>
+static Vec2T<T> operator*(const Vec2T<T> &left, typename NonDeduced<T>::type scalar) {
+    return Vec2T<T>(left.x * scalar, left.y * scalar);
 }
 
-struct Vec4 {
-    double x, y, z, w;
-    Vec4(double x, double y, double z, double w) : x(x), y(y), z(z), w(w) {}
-    Vec4() {}
+template <typename T>
+struct Vec4T {
+    T x, y, z, w;
+    Vec4T(T x, T y, T z, T w) : x(x), y(y), z(z), w(w) {}
+    Vec4T() {}
+};
+
+#ifdef RENDER_LANES
+template <>
+struct alignas(16) Vec4T<float> {
+    float x, y, z, w;
+    Vec4T(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {}
+    Vec4T(Lanes lanes) { lanes_store(&x, lanes); }
+    Vec4T() {}
+    Lanes lanes() const { return lanes_load(&x); }
 };
+#endif
+
+using Vec4 = Vec4T<real>;
 
-struct Mat4 {
-    double m00, m01, m02, m03;
-    double m10, m11, m12, m13;
-    double m20, m21, m22, m23;
-    double m30, m31, m32, m33;
-    Mat4() {
+template <typename T>
+struct Mat4T {
+    T m00, m01, m02, m03;
+    T m10, m11, m12, m13;
+    T m20, m21, m22, m23;
+    T m30, m31, m32, m33;
+    Mat4T() {
         m00 = 0;
         m01 = 0;
         m02 = 0;
@@ -111,9 +296,33 @@ struct Mat4 {
     }
 };
 
+#ifdef RENDER_LANES
+// Same row major elements, row(i) loads mi0..mi3
+template <>
+struct alignas(16) Mat4T<float> {
+    float m00, m01, m02, m03;
+    float m10, m11, m12, m13;
+    float m20, m21, m22, m23;
+    float m30, m31, m32, m33;
+    Mat4T() : Mat4T(lanes_splat(0), lanes_splat(0), lanes_splat(0), lanes_splat(0)) {}
+    Mat4T(Lanes row0, Lanes row1, Lanes row2, Lanes row3) {
+        set_row(0, row0);
+        set_row(1, row1);
+        set_row(2, row2);
+        set_row(3, row3);
+    }
+    Lanes row(int i) const { return lanes_load(reinterpret_cast<const float*>(this) + 4 * i); }
+    void set_row(int i, Lanes lanes) { lanes_store(reinterpret_cast<float*>(this) + 4 * i, lanes); }
+};
+static_assert(sizeof(Mat4T<float>) == 16 * sizeof(float), "Mat4 rows have to be back to back");
+#endif
+
+using Mat4 = Mat4T<real>;
+
 // NOTE(Ben): Hopefully this is right
-static Vec4 operator*(const Mat4& mat, const Vec4& vec) {
-    return Vec4(
+template <typename T>
+static Vec4T<T> operator*(const Mat4T<T>& mat, const Vec4T<T>& vec) {
+    return Vec4T<T>(
         mat.m00 * vec.x + mat.m01 * vec.y + mat.m02 * vec.z + mat.m03 * vec.w,
         mat.m10 * vec.x + mat.m11 * vec.y + mat.m12 * vec.z + mat.m13 * vec.w,
         mat.m20 * vec.x + mat.m21 * vec.y + mat.m22 * vec.z + mat.m23 * vec.w,
@@ -122,8 +331,9 @@ static Vec4 operator*(const Mat4& mat, const Vec4& vec) {
 }
 
 // RIP this was sad
-static Mat4 operator*(const Mat4& left, const Mat4& right) {
-    Mat4 result;
+template <typename T>
+static Mat4T<T> operator*(const Mat4T<T>& left, const Mat4T<T>& right) {
+    Mat4T<T> result;
 
     result.m00 = left.m00 * right.m00 + left.m01 * right.m10 + left.m02 * right.m20 + left.m03 * right.m30;
     result.m01 = left.m00 * right.m01 + left.m01 * right.m11 + left.m02 * right.m21 + left.m03 * right.m31;
@@ -148,4 +358,100 @@ static Mat4 operator*(const Mat4& left, const Mat4& right) {
     return result;
 }
 
+// out[i] = mat * in[i] for n vectors. in and out may be the same array.
+template <typename T>
+static void transform(const Mat4T<T>& mat, const Vec4T<T>* in, Vec4T<T>* out, int n) {
+    for (int i = 0; i < n; i++) {
+        out[i] = mat * in[i];
+    }
+}
+
+#ifdef RENDER_LANES
+
+static inline bool operator==(const Vec3T<float>& left, const Vec3T<float>& right) {
+    return lanes_equal3(left.lanes(), right.lanes());
+}
+
+static inline Vec3T<float> operator+(const Vec3T<float>& left, const Vec3T<float>& right) {
+    return lanes_add(left.lanes(), right.lanes());
+}
+
+static inline Vec3T<float> operator-(const Vec3T<float>& left, const Vec3T<float>& right) {
+    return lanes_sub(left.lanes(), right.lanes());
+}
+
+static inline Vec3T<float> operator*(const Vec3T<float>& left, const Vec3T<float>& right) {
+    return lanes_mul(left.lanes(), right.lanes());
+}
+
+static inline Vec3T<float> operator*(float scalar, const Vec3T<float>& vec) {
+    return lanes_mul(lanes_splat(scalar), vec.lanes());
+}
+
+static inline Vec3T<float> operator/(const Vec3T<float>& vec, float scalar) {
+    return lanes_div(vec.lanes(), lanes_splat(scalar));
+}
+
+static inline float dot(const Vec3T<float>& left, const Vec3T<float>& right) {
+    return lanes_dot3(left.lanes(), right.lanes());
+}
+
+static inline Vec3T<float> cross(const Vec3T<float>& left, const Vec3T<float>& right) {
+    return lanes_cross3(left.lanes(), right.lanes());
+}
+
+static inline float magnitude(const Vec3T<float>& vec) {
+    return lanes_length3(vec.lanes());
+}
+
+static inline Vec3T<float> normalize(const Vec3T<float>& vec) {
+    Lanes lanes = vec.lanes();
+    return lanes_mul(lanes, lanes_inverse_length3(lanes));
+}
+
+static inline Vec4T<float> operator*(const Mat4T<float>& mat, const Vec4T<float>& vec) {
+    // one row times vec per register, then a transpose lines the four sums up
+    Lanes lanes = vec.lanes();
+    Lanes x = lanes_mul(mat.row(0), lanes);
+    Lanes y = lanes_mul(mat.row(1), lanes);
+    Lanes z = lanes_mul(mat.row(2), lanes);
+    Lanes w = lanes_mul(mat.row(3), lanes);
+    lanes_transpose(x, y, z, w);
+    return lanes_add(lanes_add(x, y), lanes_add(z, w));
+}
+
+static inline Mat4T<float> operator*(const Mat4T<float>& left, const Mat4T<float>& right) {
+    // row i of the result is the sum of left.mik * right.row(k)
+    Lanes right0 = right.row(0);
+    Lanes right1 = right.row(1);
+    Lanes right2 = right.row(2);
+    Lanes right3 = right.row(3);
+    Lanes rows[4];
+    for (int i = 0; i < 4; i++) {
+        Lanes row = left.row(i);
+        Lanes sum = lanes_mul(lanes_broadcast<0>(row), right0);
+        sum = lanes_add(sum, lanes_mul(lanes_broadcast<1>(row), right1));
+        sum = lanes_add(sum, lanes_mul(lanes_broadcast<2>(row), right2));
+        sum = lanes_add(sum, lanes_mul(lanes_broadcast<3>(row), right3));
+        rows[i] = sum;
+    }
+    return Mat4T<float>(rows[0], rows[1], rows[2], rows[3]);
+}
+
+static inline void transform(const Mat4T<float>& mat, const Vec4T<float>* in, Vec4T<float>* out, int n) {
+    // columns, so every vector is four broadcasts times a column each
+    Lanes c0 = mat.row(0);
+    Lanes c1 = mat.row(1);
+    Lanes c2 = mat.row(2);
+    Lanes c3 = mat.row(3);
+    lanes_transpose(c0, c1, c2, c3);
+    for (int i = 0; i < n; i++) {
+        Lanes v = in[i].lanes();
+        Lanes sum = lanes_add(lanes_mul(lanes_broadcast<0>(v), c0), lanes_mul(lanes_broadcast<1>(v), c1));
+        out[i] = lanes_add(sum, lanes_add(lanes_mul(lanes_broadcast<2>(v), c2), lanes_mul(lanes_broadcast<3>(v), c3)));
+    }
+}
+
+#endif
+
 #endif // !RENDER_H
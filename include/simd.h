@@ -0,0 +1,357 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+// Thin wrappers over the widest float vector the compiler is allowed to use, so kernels can be
+// written once. vfloat holds simd_width lanes, vint as many 32 bit integers, vmask is the result
+// of a lane-wise comparison.
+// Everything that depends on the instruction set lives in a namespace named after it: the
+// raytracer compiles its kernels once per instruction set (kernels.h) and the copies must not
+// share inline functions.
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#define SIMD_AVX512 1
+#define SIMD_NAMESPACE simd_avx512
+#define SIMD_ISA_NAME "avx512"
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_AVX2 1
+#define SIMD_NAMESPACE simd_avx2
+#define SIMD_ISA_NAME "avx2"
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_SSE2 1
+#define SIMD_NAMESPACE simd_sse2
+#define SIMD_ISA_NAME "sse2"
+#else
+#define SIMD_NAMESPACE simd_scalar
+#define SIMD_ISA_NAME "scalar"
+#endif
+
+// Widest simd_width of any kernel copy. SoA arrays are padded by this much so every copy can load
+// a full vector past the last element.
+constexpr int max_simd_width = 16;
+
+namespace SIMD_NAMESPACE {
+
+#if defined(SIMD_AVX512)
+
+constexpr int simd_width = 16;
+
+struct vmask {
+    __mmask16 v;
+};
+
+struct vfloat {
+    __m512 v;
+    vfloat() {}
+    vfloat(__m512 v) : v(v) {}
+    vfloat(float scalar) : v(_mm512_set1_ps(scalar)) {}
+    static vfloat load(const float* pointer) { return _mm512_load_ps(pointer); }
+    static vfloat loadu(const float* pointer) { return _mm512_loadu_ps(pointer); }
+    static vfloat lane_index() { return _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15); }
+    void store(float* pointer) const { _mm512_store_ps(pointer, v); }
+};
+
+static inline vfloat operator+(vfloat left, vfloat right) { return _mm512_add_ps(left.v, right.v); }
+static inline vfloat operator-(vfloat left, vfloat right) { return _mm512_sub_ps(left.v, right.v); }
+static inline vfloat operator*(vfloat left, vfloat right) { return _mm512_mul_ps(left.v, right.v); }
+static inline vfloat operator/(vfloat left, vfloat right) { return _mm512_div_ps(left.v, right.v); }
+static inline vfloat vmin(vfloat left, vfloat right) { return _mm512_min_ps(left.v, right.v); }
+static inline vfloat vmax(vfloat left, vfloat right) { return _mm512_max_ps(left.v, right.v); }
+static inline vfloat vsqrt(vfloat value) { return _mm512_sqrt_ps(value.v); }
+static inline vfloat vtrunc(vfloat value) { return _mm512_cvtepi32_ps(_mm512_cvttps_epi32(value.v)); }
+// 2^n for integer valued n in [-126, 127]
+static inline vfloat vexp2i(vfloat n) {
+    __m512i exponent = _mm512_add_epi32(_mm512_cvttps_epi32(n.v), _mm512_set1_epi32(127));
+    return _mm512_castsi512_ps(_mm512_slli_epi32(exponent, 23));
+}
+static inline vmask operator<(vfloat left, vfloat right) { return {_mm512_cmp_ps_mask(left.v, right.v, _CMP_LT_OQ)}; }
+static inline vmask operator>(vfloat left, vfloat right) { return {_mm512_cmp_ps_mask(left.v, right.v, _CMP_GT_OQ)}; }
+static inline vmask operator<=(vfloat left, vfloat right) { return {_mm512_cmp_ps_mask(left.v, right.v, _CMP_LE_OQ)}; }
+static inline vmask operator>=(vfloat left, vfloat right) { return {_mm512_cmp_ps_mask(left.v, right.v, _CMP_GE_OQ)}; }
+static inline vmask operator&(vmask left, vmask right) { return {(__mmask16)(left.v & right.v)}; }
+static inline vmask operator|(vmask left, vmask right) { return {(__mmask16)(left.v | right.v)}; }
+static inline int bits(vmask mask) { return mask.v; }
+static inline vfloat select(vmask mask, vfloat on_true, vfloat on_false) {
+    return _mm512_mask_blend_ps(mask.v, on_false.v, on_true.v);
+}
+// Largest lane
+static inline float reduce_max(vfloat value) { return _mm512_reduce_max_ps(value.v); }
+// Truncates every lane to an integer, clamps it to 0..255 and stores simd_width bytes
+static inline void store_bytes(vfloat value, unsigned char* pointer) {
+    __m512i integers = _mm512_max_epi32(_mm512_cvttps_epi32(value.v), _mm512_setzero_si512());
+    _mm_storeu_si128((__m128i*)pointer, _mm512_cvtusepi32_epi8(integers));
+}
+
+struct vint {
+    __m512i v;
+    vint() {}
+    vint(__m512i v) : v(v) {}
+    vint(int scalar) : v(_mm512_set1_epi32(scalar)) {}
+    static vint load(const int* pointer) { return _mm512_load_si512(pointer); }
+    void store(int* pointer) const { _mm512_store_si512(pointer, v); }
+};
+
+static inline vint operator+(vint left, vint right) { return _mm512_add_epi32(left.v, right.v); }
+static inline vint operator|(vint left, vint right) { return _mm512_or_si512(left.v, right.v); }
+static inline vmask nonnegative(vint value) { return {_mm512_cmpge_epi32_mask(value.v, _mm512_setzero_si512())}; }
+static inline vint select(vmask mask, vint on_true, vint on_false) {
+    return _mm512_mask_blend_epi32(mask.v, on_false.v, on_true.v);
+}
+
+#elif defined(SIMD_AVX2)
+
+constexpr int simd_width = 8;
+
+struct vmask {
+    __m256 v;
+};
+
+struct vfloat {
+    __m256 v;
+    vfloat() {}
+    vfloat(__m256 v) : v(v) {}
+    vfloat(float scalar) : v(_mm256_set1_ps(scalar)) {}
+    static vfloat load(const float* pointer) { return _mm256_load_ps(pointer); }
+    static vfloat loadu(const float* pointer) { return _mm256_loadu_ps(pointer); }
+    static vfloat lane_index() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+    void store(float* pointer) const { _mm256_store_ps(pointer, v); }
+};
+
+static inline vfloat operator+(vfloat left, vfloat right) { return _mm256_add_ps(left.v, right.v); }
+static inline vfloat operator-(vfloat left, vfloat right) { return _mm256_sub_ps(left.v, right.v); }
+static inline vfloat operator*(vfloat left, vfloat right) { return _mm256_mul_ps(left.v, right.v); }
+static inline vfloat operator/(vfloat left, vfloat right) { return _mm256_div_ps(left.v, right.v); }
+static inline vfloat vmin(vfloat left, vfloat right) { return _mm256_min_ps(left.v, right.v); }
+static inline vfloat vmax(vfloat left, vfloat right) { return _mm256_max_ps(left.v, right.v); }
+static inline vfloat vsqrt(vfloat value) { return _mm256_sqrt_ps(value.v); }
+static inline vfloat vtrunc(vfloat value) { return _mm256_cvtepi32_ps(_mm256_cvttps_epi32(value.v)); }
+static inline vfloat vexp2i(vfloat n) {
+    __m256i exponent = _mm256_add_epi32(_mm256_cvttps_epi32(n.v), _mm256_set1_epi32(127));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(exponent, 23));
+}
+static inline vmask operator<(vfloat left, vfloat right) { return {_mm256_cmp_ps(left.v, right.v, _CMP_LT_OQ)}; }
+static inline vmask operator>(vfloat left, vfloat right) { return {_mm256_cmp_ps(left.v, right.v, _CMP_GT_OQ)}; }
+static inline vmask operator<=(vfloat left, vfloat right) { return {_mm256_cmp_ps(left.v, right.v, _CMP_LE_OQ)}; }
+static inline vmask operator>=(vfloat left, vfloat right) { return {_mm256_cmp_ps(left.v, right.v, _CMP_GE_OQ)}; }
+static inline vmask operator&(vmask left, vmask right) { return {_mm256_and_ps(left.v, right.v)}; }
+static inline vmask operator|(vmask left, vmask right) { return {_mm256_or_ps(left.v, right.v)}; }
+static inline int bits(vmask mask) { return _mm256_movemask_ps(mask.v); }
+// lanes of on_true where mask is set, on_false elsewhere
+static inline vfloat select(vmask mask, vfloat on_true, vfloat on_false) {
+    return _mm256_blendv_ps(on_false.v, on_true.v, mask.v);
+}
+static inline float reduce_max(vfloat value) {
+    __m128 half = _mm_max_ps(_mm256_castps256_ps128(value.v), _mm256_extractf128_ps(value.v, 1));
+    half = _mm_max_ps(half, _mm_movehl_ps(half, half));
+    return _mm_cvtss_f32(_mm_max_ss(half, _mm_shuffle_ps(half, half, 1)));
+}
+static inline void store_bytes(vfloat value, unsigned char* pointer) {
+    __m256i integers = _mm256_cvttps_epi32(value.v);
+    __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(integers), _mm256_extracti128_si256(integers, 1));
+    _mm_storel_epi64((__m128i*)pointer, _mm_packus_epi16(words, words));
+}
+
+struct vint {
+    __m256i v;
+    vint() {}
+    vint(__m256i v) : v(v) {}
+    vint(int scalar) : v(_mm256_set1_epi32(scalar)) {}
+    static vint load(const int* pointer) { return _mm256_load_si256((const __m256i*)pointer); }
+    void store(int* pointer) const { _mm256_store_si256((__m256i*)pointer, v); }
+};
+
+static inline vint operator+(vint left, vint right) { return _mm256_add_epi32(left.v, right.v); }
+static inline vint operator|(vint left, vint right) { return _mm256_or_si256(left.v, right.v); }
+static inline vmask nonnegative(vint value) {
+    return {_mm256_castsi256_ps(_mm256_cmpgt_epi32(value.v, _mm256_set1_epi32(-1)))};
+}
+static inline vint select(vmask mask, vint on_true, vint on_false) {
+    return _mm256_castps_si256(
+        _mm256_blendv_ps(_mm256_castsi256_ps(on_false.v), _mm256_castsi256_ps(on_true.v), mask.v));
+}
+
+#elif defined(SIMD_SSE2)
+
+constexpr int simd_width = 4;
+
+struct vmask {
+    __m128 v;
+};
+
+struct vfloat {
+    __m128 v;
+    vfloat() {}
+    vfloat(__m128 v) : v(v) {}
+    vfloat(float scalar) : v(_mm_set1_ps(scalar)) {}
+    static vfloat load(const float* pointer) { return _mm_load_ps(pointer); }
+    static vfloat loadu(const float* pointer) { return _mm_loadu_ps(pointer); }
+    static vfloat lane_index() { return _mm_setr_ps(0, 1, 2, 3); }
+    void store(float* pointer) const { _mm_store_ps(pointer, v); }
+};
+
+static inline vfloat operator+(vfloat left, vfloat right) { return _mm_add_ps(left.v, right.v); }
+static inline vfloat operator-(vfloat left, vfloat right) { return _mm_sub_ps(left.v, right.v); }
+static inline vfloat operator*(vfloat left, vfloat right) { return _mm_mul_ps(left.v, right.v); }
+static inline vfloat operator/(vfloat left, vfloat right) { return _mm_div_ps(left.v, right.v); }
+static inline vfloat vmin(vfloat left, vfloat right) { return _mm_min_ps(left.v, right.v); }
+static inline vfloat vmax(vfloat left, vfloat right) { return _mm_max_ps(left.v, right.v); }
+static inline vfloat vsqrt(vfloat value) { return _mm_sqrt_ps(value.v); }
+static inline vfloat vtrunc(vfloat value) { return _mm_cvtepi32_ps(_mm_cvttps_epi32(value.v)); }
+static inline vfloat vexp2i(vfloat n) {
+    __m128i exponent = _mm_add_epi32(_mm_cvttps_epi32(n.v), _mm_set1_epi32(127));
+    return _mm_castsi128_ps(_mm_slli_epi32(exponent, 23));
+}
+static inline vmask operator<(vfloat left, vfloat right) { return {_mm_cmplt_ps(left.v, right.v)}; }
+static inline vmask operator>(vfloat left, vfloat right) { return {_mm_cmpgt_ps(left.v, right.v)}; }
+static inline vmask operator<=(vfloat left, vfloat right) { return {_mm_cmple_ps(left.v, right.v)}; }
+static inline vmask operator>=(vfloat left, vfloat right) { return {_mm_cmpge_ps(left.v, right.v)}; }
+static inline vmask operator&(vmask left, vmask right) { return {_mm_and_ps(left.v, right.v)}; }
+static inline vmask operator|(vmask left, vmask right) { return {_mm_or_ps(left.v, right.v)}; }
+static inline int bits(vmask mask) { return _mm_movemask_ps(mask.v); }
+static inline vfloat select(vmask mask, vfloat on_true, vfloat on_false) {
+    return _mm_or_ps(_mm_and_ps(mask.v, on_true.v), _mm_andnot_ps(mask.v, on_false.v));
+}
+static inline float reduce_max(vfloat value) {
+    __m128 half = _mm_max_ps(value.v, _mm_movehl_ps(value.v, value.v));
+    return _mm_cvtss_f32(_mm_max_ss(half, _mm_shuffle_ps(half, half, 1)));
+}
+static inline void store_bytes(vfloat value, unsigned char* pointer) {
+    __m128i words = _mm_packs_epi32(_mm_cvttps_epi32(value.v), _mm_setzero_si128());
+    int packed = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+    std::memcpy(pointer, &packed, 4);
+}
+
+struct vint {
+    __m128i v;
+    vint() {}
+    vint(__m128i v) : v(v) {}
+    vint(int scalar) : v(_mm_set1_epi32(scalar)) {}
+    static vint load(const int* pointer) { return _mm_load_si128((const __m128i*)pointer); }
+    void store(int* pointer) const { _mm_store_si128((__m128i*)pointer, v); }
+};
+
+static inline vint operator+(vint left, vint right) { return _mm_add_epi32(left.v, right.v); }
+static inline vint operator|(vint left, vint right) { return _mm_or_si128(left.v, right.v); }
+static inline vmask nonnegative(vint value) { return {_mm_castsi128_ps(_mm_cmpgt_epi32(value.v, _mm_set1_epi32(-1)))}; }
+static inline vint select(vmask mask, vint on_true, vint on_false) {
+    __m128i lanes = _mm_castps_si128(mask.v);
+    return _mm_or_si128(_mm_and_si128(lanes, on_true.v), _mm_andnot_si128(lanes, on_false.v));
+}
+
+#else
+
+// NOTE: no vector unit we know about, the kernels still work one lane at a time
+
+constexpr int simd_width = 1;
+
+struct vmask {
+    bool v;
+};
+
+struct vfloat {
+    float v;
+    vfloat() {}
+    vfloat(float scalar) : v(scalar) {}
+    static vfloat load(const float* pointer) { return *pointer; }
+    static vfloat loadu(const float* pointer) { return *pointer; }
+    static vfloat lane_index() { return 0.0f; }
+    void store(float* pointer) const { *pointer = v; }
+};
+
+static inline vfloat operator+(vfloat left, vfloat right) { return left.v + right.v; }
+static inline vfloat operator-(vfloat left, vfloat right) { return left.v - right.v; }
+static inline vfloat operator*(vfloat left, vfloat right) { return left.v * right.v; }
+static inline vfloat operator/(vfloat left, vfloat right) { return left.v / right.v; }
+static inline vfloat vmin(vfloat left, vfloat right) { return left.v < right.v ? left.v : right.v; }
+static inline vfloat vmax(vfloat left, vfloat right) { return left.v > right.v ? left.v : right.v; }
+static inline vfloat vsqrt(vfloat value) { return std::sqrt(value.v); }
+static inline vfloat vtrunc(vfloat value) { return std::trunc(value.v); }
+static inline vfloat vexp2i(vfloat n) { return std::ldexp(1.0f, (int)n.v); }
+static inline vmask operator<(vfloat left, vfloat right) { return {left.v < right.v}; }
+static inline vmask operator>(vfloat left, vfloat right) { return {left.v > right.v}; }
+static inline vmask operator<=(vfloat left, vfloat right) { return {left.v <= right.v}; }
+static inline vmask operator>=(vfloat left, vfloat right) { return {left.v >= right.v}; }
+static inline vmask operator&(vmask left, vmask right) { return {left.v && right.v}; }
+static inline vmask operator|(vmask left, vmask right) { return {left.v || right.v}; }
+static inline int bits(vmask mask) { return mask.v ? 1 : 0; }
+static inline vfloat select(vmask mask, vfloat on_true, vfloat on_false) {
+    return mask.v ? on_true : on_false;
+}
+static inline float reduce_max(vfloat value) { return value.v; }
+static inline void store_bytes(vfloat value, unsigned char* pointer) {
+    *pointer = value.v >= 255.0f ? 255 : value.v > 0.0f ? (unsigned char)value.v : 0;
+}
+
+struct vint {
+    int v;
+    vint() {}
+    vint(int scalar) : v(scalar) {}
+    static vint load(const int* pointer) { return *pointer; }
+    void store(int* pointer) const { *pointer = v; }
+};
+
+static inline vint operator+(vint left, vint right) { return left.v + right.v; }
+static inline vint operator|(vint left, vint right) { return left.v | right.v; }
+static inline vmask nonnegative(vint value) { return {value.v >= 0}; }
+static inline vint select(vmask mask, vint on_true, vint on_false) {
+    return mask.v ? on_true : on_false;
+}
+
+#endif
+
+// e^x for x <= 0, to about 3e-4 relative. Meant for filter weights: below e^-87 it stops
+// shrinking instead of going denormal.
+static inline vfloat vexp_negative(vfloat x) {
+    vfloat y = vmax(x * vfloat(1.44269504f), vfloat(-126.0f));
+    vfloat n = vtrunc(y);
+    vfloat t = (y - n) * vfloat(0.69314718f); // 2^(y - n) = e^t, t in (-ln 2, 0]
+    vfloat p = vfloat(1.0f / 24) + t * vfloat(1.0f / 120);
+    p = vfloat(1.0f / 6) + t * p;
+    p = vfloat(0.5f) + t * p;
+    p = vfloat(1.0f) + t * p;
+    p = vfloat(1.0f) + t * p;
+    return p * vexp2i(n);
+}
+
+} // namespace SIMD_NAMESPACE
+
+using namespace SIMD_NAMESPACE;
+
+// Allocator for std::vector so SoA arrays can be read with aligned vector loads
+template <typename T, size_t Alignment = 64>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() {}
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t count) {
+        return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(Alignment)));
+    }
+    void deallocate(T* pointer, size_t) {
+        ::operator delete(pointer, std::align_val_t(Alignment));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+using aligned_floats = std::vector<float, AlignedAllocator<float>>;
+
+#endif // !SIMD_H
@@ -0,0 +1,60 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool used to split a frame into independent jobs (tiles, rows, ...).
+// Every worker owns a deque of job indices. It pops from the front of its own deque and, once
+// that runs dry, steals from the back of the other workers' deques, so uneven jobs (a tile full
+// of sky next to a tile full of spheres) still keep every core busy.
+// The thread that calls parallel_for() takes part as worker 0.
+struct ThreadPool {
+    using Job = std::function<void(int job_index, int worker_index)>;
+
+    explicit ThreadPool(int thread_count = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // thread_count <= 0 means one thread per hardware thread. No-op if the count is unchanged.
+    void resize(int thread_count);
+    int size() const { return (int)queues.size(); }
+
+    // Runs job(i, worker) for every i in [0, job_count) and blocks until all of them finished.
+    void parallel_for(int job_count, const Job& job);
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<int> jobs;
+    };
+
+    void worker_loop(int worker_index);
+    void run_jobs(int worker_index, const Job& job);
+    bool pop_job(int worker_index, int& job_index);
+    void stop_threads();
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const Job* current_job = nullptr;
+    unsigned long long generation = 0;
+    int active_workers = 0;
+    bool stopping = false;
+    std::atomic<int> remaining_jobs{0};
+};
+
+int hardware_thread_count();
+
+#endif // !THREAD_POOL_H
@@ -0,0 +1,380 @@
+// Microbenchmarks for the hot functions of both renderers. Every benchmark runs a fixed,
+// seeded workload, so numbers from two builds can be compared directly.
+//
+// Each benchmark is calibrated to take about sample_ms per sample, then timed over several
+// samples. ns/op is reported as mean, standard deviation and minimum over the samples.
+//
+// --check-fill runs no benchmarks and checks the rasterizer's fill rule instead, see check_fill().
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "kernels.h"
+#include "mesh.h"
+#include "raster_kernels.h"
+#include "rasterizer.h"
+#include "raytracer.h"
+
+// Keeps the compiler from dropping work whose result is never used
+template <typename T>
+static void keep(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+struct BenchResult {
+    std::string name;
+    double mean_ns = 0;   // per op
+    double stddev_ns = 0;
+    double min_ns = 0;
+    double bytes_per_op = 0; // for the parsing benchmarks, 0 otherwise
+};
+
+static int sample_count = 15;
+static double sample_ms = 20;
+static const char* filter = nullptr;
+
+// body(iterations) runs iterations ops. bytes_per_op adds a MB/s column.
+template <typename Body>
+static void run_benchmark(const std::string& name, Body body, double bytes_per_op = 0) {
+    if (filter && name.find(filter) == std::string::npos) {
+        return;
+    }
+    using clock = std::chrono::steady_clock;
+    auto time_ns = [&](long long iterations) {
+        auto start = clock::now();
+        body(iterations);
+        return std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    };
+
+    // warm up, then grow the iteration count until one sample takes long enough
+    body(1);
+    long long iterations = 1;
+    double elapsed = time_ns(iterations);
+    while (elapsed < sample_ms * 1e6 && iterations < (1ll << 40)) {
+        double scale = elapsed > 0 ? std::min(10.0, 1.2 * sample_ms * 1e6 / elapsed) : 10.0;
+        iterations = std::max(iterations + 1, (long long)(iterations * scale));
+        elapsed = time_ns(iterations);
+    }
+
+    std::vector<double> samples(sample_count);
+    for (double& sample : samples) {
+        sample = time_ns(iterations) / iterations;
+    }
+    BenchResult result;
+    result.name = name;
+    result.bytes_per_op = bytes_per_op;
+    for (double sample : samples) {
+        result.mean_ns += sample / sample_count;
+    }
+    for (double sample : samples) {
+        result.stddev_ns += (sample - result.mean_ns) * (sample - result.mean_ns) / std::max(1, sample_count - 1);
+    }
+    result.stddev_ns = std::sqrt(result.stddev_ns);
+    result.min_ns = *std::min_element(samples.begin(), samples.end());
+
+    std::printf("%-32s %12.2f %8.2f%% %12.2f %12.3f", name.c_str(), result.mean_ns,
+                100 * result.stddev_ns / result.mean_ns, result.min_ns, 1e3 / result.mean_ns);
+    if (bytes_per_op > 0) {
+        std::printf(" %10.1f MB/s", bytes_per_op / result.mean_ns * 1e3);
+    }
+    std::printf("\n");
+    std::fflush(stdout);
+}
+
+// Rays from around the camera towards the scene, the same for every run
+static std::vector<Ray> make_rays(int count) {
+    Rng rng = seed_rng(1234, 0);
+    std::vector<Ray> rays;
+    for (int i = 0; i < count; i++) {
+        Vec3 direction(random_double(rng) * 2 - 1, random_double(rng) - 0.7, -1);
+        rays.push_back(Ray(Vec3(0, 0, 3), direction));
+    }
+    return rays;
+}
+
+static std::vector<Object> make_scene(int sphere_count) {
+    Rng rng = seed_rng(4321, 0);
+    std::vector<Object> scene;
+    scene.push_back(create_sphere(Vec3(0, -100.5, -1), 100, Color(10, 10, 210)));
+    double extent = std::sqrt((double)sphere_count);
+    for (int i = 1; i < sphere_count; i++) {
+        double radius = 0.05 + 0.15 * random_double(rng);
+        Vec3 position(extent * (random_double(rng) * 2 - 1), -0.5 + radius, -1 - extent * random_double(rng));
+        scene.push_back(create_sphere(position, radius, Color(200, 100, 50)));
+    }
+    return scene;
+}
+
+static void bench_raytracer() {
+    std::vector<Ray> rays = make_rays(4096);
+    const int ray_mask = 4095;
+
+    run_benchmark("hit_sphere", [&](long long iterations) {
+        HitRecord hit_record;
+        int hits = 0;
+        for (long long i = 0; i < iterations; i++) {
+            hits += hit_sphere(Vec3(0, 0, -1), 0.5, rays[i & ray_mask], 0.001, 1e30, hit_record);
+        }
+        keep(hits);
+    });
+
+    for (bool bvh : {false, true}) {
+        for (int sphere_count : {16, 1000, 100000}) {
+            // the flat loop over 100k spheres per ray would take most of the run
+            if (!bvh && sphere_count > 1000) {
+                continue;
+            }
+            std::vector<Object> scene = make_scene(sphere_count);
+            use_bvh = bvh;
+            build_scene(scene.data(), (int)scene.size());
+            char name[64];
+            std::snprintf(name, sizeof(name), "hit_scene/%s/%d", bvh ? "bvh" : "flat", sphere_count);
+            run_benchmark(name, [&](long long iterations) {
+                HitRecord hit_record;
+                int hits = 0;
+                for (long long i = 0; i < iterations; i++) {
+                    hits += hit_scene(rays[i & ray_mask], scene.data(), (int)scene.size(), hit_record);
+                }
+                keep(hits);
+            });
+        }
+    }
+    use_bvh = true;
+}
+
+static void bench_rasterizer() {
+    // points in and around a mid sized screen space triangle
+    Vec3 v0(100, 100, 0.5);
+    Vec3 v1(300, 120, 0.5);
+    Vec3 v2(180, 260, 0.5);
+    std::vector<Vec3> points(1024);
+    Rng rng = seed_rng(99, 0);
+    for (Vec3& point : points) {
+        point = Vec3(80 + 240 * random_double(rng), 80 + 200 * random_double(rng), 0);
+    }
+    run_benchmark("barycentric", [&](long long iterations) {
+        double sum = 0;
+        for (long long i = 0; i < iterations; i++) {
+            sum += barycentric(v0, v1, v2, points[i & 1023]).x;
+        }
+        keep(sum);
+    });
+
+    std::vector<Color> framebuffer(width * height);
+    for (int size : {8, 64, 256}) {
+        Vec3 a(200, 100, 0);
+        Vec3 b(200 + size, 100 + size / 4, 0);
+        Vec3 c(200 + size / 3, 100 + size, 0);
+        char name[64];
+        std::snprintf(name, sizeof(name), "sweep_triangle/%dpx", size);
+        run_benchmark(name, [&](long long iterations) {
+            std::fill(z_buffer, z_buffer + width * height, INFINITY);
+            int pixels = 0;
+            for (long long i = 0; i < iterations; i++) {
+                // every triangle a little closer, so the depth test always passes
+                double z = 1 - (double)i / (iterations + 1);
+                a.z = b.z = c.z = z;
+                pixels += sweep_triangle(framebuffer.data(), a, b, c, Color(255, 255, 255));
+            }
+            keep(pixels);
+        });
+    }
+
+    Mat4 left = look_at(Vec3(1, 2, 3), Vec3(0, 0, 0), Vec3(0, 1, 0));
+    Mat4 right_matrix = translate(Vec3(4, 5, 6));
+    run_benchmark("Mat4*Mat4", [&](long long iterations) {
+        Mat4 result = left;
+        for (long long i = 0; i < iterations; i++) {
+            result = result * right_matrix;
+            keep(result);
+        }
+    });
+    run_benchmark("Mat4*Vec4", [&](long long iterations) {
+        Vec4 result(1, 2, 3, 1);
+        for (long long i = 0; i < iterations; i++) {
+            result = left * result;
+            keep(result);
+        }
+    });
+}
+
+// Covers the screen with a jittered grid of triangles, cell pixels apart and split along
+// alternating diagonals, drawing every triangle nearer than the last so no write fails the depth
+// test. Corners are jittered by up to a fifth of a cell, which keeps every cell convex so its two
+// triangles don't overlap, in steps of step pixels: half pixel steps put many edges right through
+// pixel centers. The grid shares every edge, so the fill rule has to write each pixel
+// exactly once: as many writes as pixels and no pixel left black. Returns false otherwise.
+static bool check_fill_grid(double cell, double step, unsigned seed) {
+    int columns = (int)std::ceil(width / cell) + 2;
+    int rows = (int)std::ceil(height / cell) + 2;
+    Rng rng = seed_rng(seed, 0);
+    int max_jitter = (int)(0.2 * cell / step);
+    auto jitter = [&] {
+        return step * ((int)(random_double(rng) * (2 * max_jitter + 1)) - max_jitter);
+    };
+    std::vector<Vec3> corners;
+    for (int y = 0; y <= rows; y++) {
+        for (int x = 0; x <= columns; x++) {
+            corners.push_back(Vec3((x - 1) * cell + jitter(), (y - 1) * cell + jitter(), 0));
+        }
+    }
+    auto corner = [&](int x, int y) {
+        return corners[y * (columns + 1) + x];
+    };
+
+    std::vector<Color> framebuffer(width * height, Color(0, 0, 0));
+    std::fill(z_buffer, z_buffer + width * height, INFINITY);
+    long long writes = 0;
+    int triangle_count = 2 * rows * columns;
+    int triangle = 0;
+    auto draw = [&](Vec3 a, Vec3 b, Vec3 c) {
+        a.z = b.z = c.z = 1 - (double)++triangle / (triangle_count + 1);
+        writes += sweep_triangle(framebuffer.data(), a, b, c, Color(255, 255, 255));
+    };
+    for (int y = 0; y < rows; y++) {
+        for (int x = 0; x < columns; x++) {
+            Vec3 p00 = corner(x, y), p10 = corner(x + 1, y), p01 = corner(x, y + 1), p11 = corner(x + 1, y + 1);
+            if ((x + y) % 2 == 0) {
+                draw(p00, p10, p11);
+                draw(p00, p11, p01);
+            } else {
+                draw(p00, p10, p01);
+                draw(p10, p11, p01);
+            }
+        }
+    }
+    long long gaps = 0;
+    for (const Color& pixel : framebuffer) {
+        gaps += pixel.r == 0;
+    }
+    bool exact = writes == (long long)width * height && gaps == 0;
+    std::printf("%-8s cell %5.1f px, jitter step %6.4f px: %lld writes for %d pixels, %lld gaps%s\n",
+                raster_kernels.isa, cell, step, writes, width * height, gaps, exact ? "" : "  FAILED");
+    return exact;
+}
+
+// Checks that triangles sharing edges neither overlap nor leave gaps, with every copy of the
+// rasterizer kernels this CPU runs
+static bool check_fill() {
+    bool exact = true;
+    std::string isas = available_raster_kernels();
+    for (size_t start = 0; start < isas.size();) {
+        size_t end = std::min(isas.find(',', start), isas.size());
+        std::string isa = isas.substr(start, end - start);
+        start = end + 1;
+        if (!select_raster_kernels(isa.c_str())) {
+            continue;
+        }
+        exact &= check_fill_grid(1.5, 1.0 / 16, 11);
+        exact &= check_fill_grid(7, 0.5, 12);
+        exact &= check_fill_grid(7, 1.0 / 16, 13);
+        exact &= check_fill_grid(40, 1.0 / 16, 14);
+        exact &= check_fill_grid(150, 0.5, 15);
+    }
+    select_raster_kernels("best");
+    return exact;
+}
+
+// A UV sphere in OBJ form, with quads in the middle and triangles at the poles
+static std::string make_obj(int rings) {
+    const double pi = 3.141592653589793238462643383;
+    int segments = 2 * rings;
+    std::string obj = "v 0 1 0\n";
+    char line[128];
+    for (int r = 1; r < rings; r++) {
+        for (int s = 0; s < segments; s++) {
+            double theta = pi * r / rings;
+            double phi = 2 * pi * s / segments;
+            std::snprintf(line, sizeof(line), "v %.9f %.9f %.9f\n", std::sin(theta) * std::cos(phi), std::cos(theta),
+                          std::sin(theta) * std::sin(phi));
+            obj += line;
+        }
+    }
+    obj += "v 0 -1 0\n";
+    auto index = [&](int r, int s) {
+        return 2 + (r - 1) * segments + s % segments;
+    };
+    int bottom = 2 + (rings - 1) * segments;
+    for (int s = 0; s < segments; s++) {
+        std::snprintf(line, sizeof(line), "f 1 %d %d\n", index(1, s + 1), index(1, s));
+        obj += line;
+        std::snprintf(line, sizeof(line), "f %d %d %d\n", index(rings - 1, s), index(rings - 1, s + 1), bottom);
+        obj += line;
+    }
+    for (int r = 1; r < rings - 1; r++) {
+        for (int s = 0; s < segments; s++) {
+            std::snprintf(line, sizeof(line), "f %d/1/1 %d/1/1 %d/1/1 %d/1/1\n", index(r, s), index(r, s + 1),
+                          index(r + 1, s + 1), index(r + 1, s));
+            obj += line;
+        }
+    }
+    return obj;
+}
+
+static void bench_mesh() {
+    std::string face_line = "f 1234/5/6 2345/6/7 3456/7/8 4567/8/9";
+    run_benchmark("split/face", [&](long long iterations) {
+        size_t parts = 0;
+        for (long long i = 0; i < iterations; i++) {
+            parts += split(face_line).size();
+        }
+        keep(parts);
+    }, (double)face_line.size());
+
+    std::string obj = make_obj(64);
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "renderer-bench.obj";
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << obj;
+    }
+    run_benchmark("load_mesh/8k_faces", [&](long long iterations) {
+        size_t faces = 0;
+        for (long long i = 0; i < iterations; i++) {
+            faces += load_mesh(path.string()).faces.size();
+        }
+        keep(faces);
+    }, (double)obj.size());
+    std::filesystem::remove(path);
+}
+
+int main(int argc, char** argv) {
+    bool fill_check = false;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--filter") == 0 && has_value) {
+            filter = argv[++i];
+        } else if (std::strcmp(argv[i], "--samples") == 0 && has_value) {
+            sample_count = std::max(2, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--sample-ms") == 0 && has_value) {
+            sample_ms = std::max(1.0, std::atof(argv[++i]));
+        } else if (std::strcmp(argv[i], "--check-fill") == 0) {
+            fill_check = true;
+        } else {
+            std::printf("usage: renderer-bench [--filter SUBSTRING] [--samples N] [--sample-ms MS] [--check-fill]\n");
+            return std::strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+    if (fill_check) {
+        return check_fill() ? 0 : 1;
+    }
+
+    std::printf("%s raytracer kernels, %s rasterizer kernels, math types in %s\n", kernels.isa, raster_kernels.isa,
+                sizeof(real) == sizeof(float) ? "float" : "double");
+    std::printf("%-32s %12s %9s %12s %12s\n", "benchmark", "ns/op", "stddev", "min ns/op", "Mops/s");
+    bench_raytracer();
+    bench_rasterizer();
+    bench_mesh();
+    return 0;
+}
@@ -0,0 +1,446 @@
+// End to end scaling benchmark. Renders generated sphere and mesh scenes over a sweep of scene
+// sizes, resolutions and thread counts, and reports frame time, throughput and parallel
+// efficiency as a table, JSON and/or CSV. A CSV report from an earlier run can be passed as a
+// baseline, any case that got slower than the tolerance is flagged and the exit code is 2.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "kernels.h"
+#include "raster_kernels.h"
+#include "rasterizer.h"
+#include "raytracer.h"
+#include "thread_pool.h"
+
+constexpr double pi = 3.141592653589793238462643383;
+
+struct ScalingResult {
+    std::string renderer; // raytracer or rasterizer
+    std::string scene;    // spheres or meshes
+    int objects = 0;
+    int width = 0;
+    int height = 0;
+    int threads = 0;
+    double build_ms = 0;   // scene setup, BVH build for the raytracer
+    double frame_ms = 0;   // median over the timed frames
+    double throughput = 0; // rays/s for the raytracer, triangles/s for the rasterizer
+    double efficiency = 1; // speedup over the fewest threads measured, divided by the thread ratio
+    double baseline_ms = 0;
+    bool regression = false;
+
+    std::string key() const {
+        char text[128];
+        std::snprintf(text, sizeof(text), "%s/%s/%d/%dx%d/%d", renderer.c_str(), scene.c_str(), objects, width,
+                      height, threads);
+        return text;
+    }
+    const char* unit() const { return renderer == "raytracer" ? "rays/s" : "triangles/s"; }
+};
+
+static void print_usage() {
+    std::printf(
+        "usage: renderer-scaling [options]\n"
+        "  --spheres LIST     sphere counts, default 10,1000,100000,1000000\n"
+        "  --models LIST      mesh instance counts, default 1,100,10000\n"
+        "  --threads LIST     thread counts, default powers of two up to every hardware thread\n"
+        "  --resolutions LIST raytracer image sizes, default 320x180,960x540\n"
+        "  --frames N         timed frames per case (after one warm up frame), default 3\n"
+        "  --spp N            samples per pixel, default 1\n"
+        "  --json FILE        write the report as JSON\n"
+        "  --csv FILE         write the report as CSV\n"
+        "  --baseline FILE    compare against a CSV report, exit code 2 on regressions\n"
+        "  --tolerance F      allowed slowdown against the baseline, default 0.1 (10%%)\n"
+        "Lists are comma separated, pass 0 to skip a scene type. The rasterizer always renders at %dx%d.\n",
+        width, height);
+}
+
+static std::vector<int> parse_list(const char* text) {
+    std::vector<int> values;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        int value = std::atoi(item.c_str());
+        if (value > 0) {
+            values.push_back(value);
+        }
+    }
+    return values;
+}
+
+// Same layout as the scatter button: small spheres on a big ground sphere, spread out further
+// the more there are
+static std::vector<Object> sphere_scene(int sphere_count) {
+    Rng rng = seed_rng(0, 0);
+    std::vector<Object> scene;
+    scene.push_back(create_sphere(Vec3(0, -100.5, -1), 100, Color(10, 10, 210)));
+    double extent = std::sqrt((double)sphere_count);
+    for (int i = 1; i < sphere_count; i++) {
+        double radius = 0.05 + 0.15 * random_double(rng);
+        Vec3 position(extent * (random_double(rng) * 2 - 1), -0.5 + radius, -1 - extent * random_double(rng));
+        Color color(random_double(rng) * 255, random_double(rng) * 255, random_double(rng) * 255);
+        scene.push_back(create_sphere(position, radius, color));
+    }
+    return scene;
+}
+
+// A UV sphere of radius 1 with quads in the middle and triangles at the poles
+static Mesh sphere_mesh(int rings) {
+    Mesh mesh;
+    int segments = 2 * rings;
+    mesh.vertices.push_back(Vec3(0, 1, 0));
+    for (int r = 1; r < rings; r++) {
+        for (int s = 0; s < segments; s++) {
+            double theta = pi * r / rings;
+            double phi = 2 * pi * s / segments;
+            mesh.vertices.push_back(
+                Vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)));
+        }
+    }
+    mesh.vertices.push_back(Vec3(0, -1, 0));
+    auto index = [&](int r, int s) {
+        return 1 + (r - 1) * segments + s % segments;
+    };
+    int bottom = (int)mesh.vertices.size() - 1;
+    for (int s = 0; s < segments; s++) {
+        mesh.faces.push_back({0, index(1, s + 1), index(1, s)});
+        mesh.faces.push_back({index(rings - 1, s), index(rings - 1, s + 1), bottom});
+    }
+    for (int r = 1; r < rings - 1; r++) {
+        for (int s = 0; s < segments; s++) {
+            mesh.faces.push_back({index(r, s), index(r, s + 1), index(r + 1, s + 1), index(r + 1, s)});
+        }
+    }
+    return mesh;
+}
+
+// Mesh instances on a square grid in front of the camera, 3 units apart
+static std::vector<Vec3> grid_positions(int count) {
+    int side = (int)std::ceil(std::sqrt((double)count));
+    std::vector<Vec3> positions;
+    for (int i = 0; i < count; i++) {
+        positions.push_back(Vec3(3.0 * (i % side - (side - 1) / 2.0), 0, -3.0 * (i / side) - 3));
+    }
+    return positions;
+}
+
+// Raised above the grid so every instance is in view
+static Vec3 grid_camera(int count) {
+    int side = (int)std::ceil(std::sqrt((double)count));
+    return Vec3(0, 1.5 * side + 1, 1.5 * side + 2);
+}
+
+static Vec3 grid_center(int count) {
+    int side = (int)std::ceil(std::sqrt((double)count));
+    return Vec3(0, 0, -1.5 * (side - 1) - 3);
+}
+
+static double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+static int frame_count = 3;
+
+// Times the raytracer on scene, already built, once per resolution and thread count
+static void run_raytracer(std::vector<ScalingResult>& results, const char* scene_name, std::vector<Object>& scene,
+                          int objects, double build_ms, const std::vector<std::pair<int, int>>& resolutions,
+                          const std::vector<int>& thread_counts) {
+    for (const std::pair<int, int>& resolution : resolutions) {
+        image_width = resolution.first;
+        image_height = resolution.second;
+        std::vector<Color> framebuffer((size_t)image_width * image_height);
+        for (int threads : thread_counts) {
+            thread_count = threads;
+            std::vector<double> frame_ms;
+            long long ray_count = 0;
+            for (int frame = 0; frame <= frame_count; frame++) {
+                render(framebuffer.data(), scene.data(), (int)scene.size());
+                if (frame > 0) {
+                    frame_ms.push_back(render_stats.frame_ms);
+                    ray_count += render_stats.ray_count;
+                }
+            }
+            ScalingResult result;
+            result.renderer = "raytracer";
+            result.scene = scene_name;
+            result.objects = objects;
+            result.width = image_width;
+            result.height = image_height;
+            result.threads = thread_count;
+            result.build_ms = build_ms;
+            result.frame_ms = median(frame_ms);
+            result.throughput = ray_count / (frame_count * result.frame_ms / 1000);
+            results.push_back(result);
+            std::printf("%-10s %-8s %8d %5dx%-5d %3d threads  %10.2f ms  %8.2f M%s\n", "raytracer", scene_name,
+                        objects, image_width, image_height, thread_count, result.frame_ms, result.throughput / 1e6,
+                        result.unit());
+            std::fflush(stdout);
+        }
+    }
+}
+
+static void run_rasterizer(std::vector<ScalingResult>& results, int model_count, const Mesh& mesh,
+                           const std::vector<int>& thread_counts) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Model> models(model_count);
+    std::vector<Vec3> positions = grid_positions(model_count);
+    for (int i = 0; i < model_count; i++) {
+        models[i].mesh = mesh;
+        models[i].position = positions[i];
+    }
+    double build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    Camera camera;
+    camera.position = grid_camera(model_count);
+    camera.direction = normalize(grid_center(model_count) - camera.position);
+    std::vector<Color> framebuffer(width * height);
+    for (int threads : thread_counts) {
+        raster_thread_count = threads;
+        std::vector<double> frame_ms;
+        long long triangle_count = 0;
+        for (int frame = 0; frame <= frame_count; frame++) {
+            render(framebuffer.data(), camera, models.data(), model_count);
+            if (frame > 0) {
+                frame_ms.push_back(raster_stats.frame_ms);
+                triangle_count += raster_stats.triangle_count;
+            }
+        }
+        ScalingResult result;
+        result.renderer = "rasterizer";
+        result.scene = "meshes";
+        result.objects = model_count;
+        result.width = width;
+        result.height = height;
+        result.threads = raster_thread_count;
+        result.build_ms = build_ms;
+        result.frame_ms = median(frame_ms);
+        result.throughput = triangle_count / (frame_count * result.frame_ms / 1000);
+        results.push_back(result);
+        std::printf("%-10s %-8s %8d %5dx%-5d %3d threads  %10.2f ms  %8.2f M%s\n", "rasterizer", "meshes",
+                    model_count, width, height, raster_thread_count, result.frame_ms, result.throughput / 1e6,
+                    result.unit());
+        std::fflush(stdout);
+    }
+}
+
+// Efficiency of every case against the case with the fewest threads that only differs in threads
+static void compute_efficiency(std::vector<ScalingResult>& results) {
+    std::map<std::string, const ScalingResult*> reference;
+    for (const ScalingResult& result : results) {
+        ScalingResult group = result;
+        group.threads = 0;
+        const ScalingResult*& slot = reference[group.key()];
+        if (!slot || result.threads < slot->threads) {
+            slot = &result;
+        }
+    }
+    for (ScalingResult& result : results) {
+        ScalingResult group = result;
+        group.threads = 0;
+        const ScalingResult* base = reference[group.key()];
+        result.efficiency = (base->frame_ms * base->threads) / (result.frame_ms * result.threads);
+    }
+}
+
+static bool write_csv(const std::string& path, const std::vector<ScalingResult>& results) {
+    std::ofstream file(path);
+    file << "renderer,scene,objects,width,height,threads,build_ms,frame_ms,throughput,unit,efficiency\n";
+    for (const ScalingResult& result : results) {
+        file << result.renderer << ',' << result.scene << ',' << result.objects << ',' << result.width << ','
+             << result.height << ',' << result.threads << ',' << result.build_ms << ',' << result.frame_ms << ','
+             << result.throughput << ',' << result.unit() << ',' << result.efficiency << '\n';
+    }
+    return (bool)file;
+}
+
+static bool write_json(const std::string& path, const std::vector<ScalingResult>& results, bool has_baseline) {
+    std::ofstream file(path);
+    file << "{\n  \"hardware_threads\": " << hardware_thread_count() << ",\n  \"precision\": \""
+         << (sizeof(real) == sizeof(float) ? "float" : "double") << "\",\n  \"kernels\": \""
+         << kernels.isa << "\",\n  \"raster_kernels\": \"" << raster_kernels.isa << "\",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const ScalingResult& result = results[i];
+        file << "    {\"renderer\": \"" << result.renderer << "\", \"scene\": \"" << result.scene
+             << "\", \"objects\": " << result.objects << ", \"width\": " << result.width
+             << ", \"height\": " << result.height << ", \"threads\": " << result.threads
+             << ", \"build_ms\": " << result.build_ms << ", \"frame_ms\": " << result.frame_ms
+             << ", \"throughput\": " << result.throughput << ", \"unit\": \"" << result.unit()
+             << "\", \"efficiency\": " << result.efficiency;
+        if (has_baseline && result.baseline_ms > 0) {
+            file << ", \"baseline_ms\": " << result.baseline_ms
+                 << ", \"regression\": " << (result.regression ? "true" : "false");
+        }
+        file << (i + 1 < results.size() ? "},\n" : "}\n");
+    }
+    file << "  ]\n}\n";
+    return (bool)file;
+}
+
+// Frame times of a CSV report by case key, empty if the file can't be read
+static std::map<std::string, double> read_baseline(const std::string& path) {
+    std::map<std::string, double> frame_ms;
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line); // header
+    while (std::getline(file, line)) {
+        std::vector<std::string> fields;
+        std::stringstream stream(line);
+        std::string field;
+        while (std::getline(stream, field, ',')) {
+            fields.push_back(field);
+        }
+        if (fields.size() < 8) {
+            continue;
+        }
+        ScalingResult result;
+        result.renderer = fields[0];
+        result.scene = fields[1];
+        result.objects = std::atoi(fields[2].c_str());
+        result.width = std::atoi(fields[3].c_str());
+        result.height = std::atoi(fields[4].c_str());
+        result.threads = std::atoi(fields[5].c_str());
+        frame_ms[result.key()] = std::atof(fields[7].c_str());
+    }
+    return frame_ms;
+}
+
+int main(int argc, char** argv) {
+    std::vector<int> sphere_counts = {10, 1000, 100000, 1000000};
+    std::vector<int> model_counts = {1, 100, 10000};
+    std::vector<int> thread_counts;
+    for (int threads = 1; threads < hardware_thread_count(); threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(hardware_thread_count());
+    std::vector<std::pair<int, int>> resolutions = {{320, 180}, {960, 540}};
+    int spp = 1;
+    std::string json_path;
+    std::string csv_path;
+    std::string baseline_path;
+    double tolerance = 0.1;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(arg, "--spheres") == 0 && has_value) {
+            sphere_counts = parse_list(argv[++i]);
+        } else if (std::strcmp(arg, "--models") == 0 && has_value) {
+            model_counts = parse_list(argv[++i]);
+        } else if (std::strcmp(arg, "--threads") == 0 && has_value) {
+            thread_counts = parse_list(argv[++i]);
+        } else if (std::strcmp(arg, "--resolutions") == 0 && has_value) {
+            resolutions.clear();
+            std::stringstream stream(argv[++i]);
+            std::string item;
+            while (std::getline(stream, item, ',')) {
+                int w = 0, h = 0;
+                if (std::sscanf(item.c_str(), "%dx%d", &w, &h) == 2 && w > 0 && h > 0) {
+                    resolutions.push_back({w, h});
+                }
+            }
+        } else if (std::strcmp(arg, "--frames") == 0 && has_value) {
+            frame_count = std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(arg, "--spp") == 0 && has_value) {
+            spp = std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(arg, "--json") == 0 && has_value) {
+            json_path = argv[++i];
+        } else if (std::strcmp(arg, "--csv") == 0 && has_value) {
+            csv_path = argv[++i];
+        } else if (std::strcmp(arg, "--baseline") == 0 && has_value) {
+            baseline_path = argv[++i];
+        } else if (std::strcmp(arg, "--tolerance") == 0 && has_value) {
+            tolerance = std::atof(argv[++i]);
+        } else {
+            print_usage();
+            return std::strcmp(arg, "--help") == 0 ? 0 : 1;
+        }
+    }
+    if (thread_counts.empty() || resolutions.empty()) {
+        print_usage();
+        return 1;
+    }
+
+    samples_per_pixel = spp;
+    accumulate = false;
+    std::vector<ScalingResult> results;
+    std::printf("%s raytracer kernels, %s rasterizer kernels, math types in %s\n", kernels.isa, raster_kernels.isa,
+                sizeof(real) == sizeof(float) ? "float" : "double");
+
+    for (int sphere_count : sphere_counts) {
+        std::vector<Object> scene = sphere_scene(sphere_count);
+        camera = Vec3(0, 0, 3);
+        camera_direction = Vec3(0, 0, 1);
+        build_scene(scene.data(), (int)scene.size());
+        run_raytracer(results, "spheres", scene, sphere_count, scene_bvh.build_ms, resolutions, thread_counts);
+    }
+
+    Mesh mesh = sphere_mesh(8);
+    int mesh_blas = model_counts.empty() ? -1 : add_mesh(mesh);
+    for (int model_count : model_counts) {
+        std::vector<Object> scene;
+        for (const Vec3& position : grid_positions(model_count)) {
+            scene.push_back(create_instance(TriangleMesh, mesh_blas, position, 1, 0, Color(200, 200, 200)));
+        }
+        // the raytracer's camera direction points backwards, away from what it looks at
+        camera = grid_camera(model_count);
+        camera_direction = normalize(camera - grid_center(model_count));
+        build_scene(scene.data(), (int)scene.size());
+        run_raytracer(results, "meshes", scene, model_count, scene_bvh.build_ms, resolutions, thread_counts);
+        run_rasterizer(results, model_count, mesh, thread_counts);
+    }
+
+    compute_efficiency(results);
+
+    int regressions = 0;
+    if (!baseline_path.empty()) {
+        std::map<std::string, double> baseline = read_baseline(baseline_path);
+        if (baseline.empty()) {
+            std::fprintf(stderr, "no results in baseline %s\n", baseline_path.c_str());
+            return 1;
+        }
+        for (ScalingResult& result : results) {
+            auto it = baseline.find(result.key());
+            if (it == baseline.end()) {
+                continue;
+            }
+            result.baseline_ms = it->second;
+            result.regression = result.frame_ms > result.baseline_ms * (1 + tolerance);
+            regressions += result.regression;
+        }
+    }
+
+    std::printf("\n%-44s %10s %10s %12s %10s\n", "case", "frame ms", "baseline", "Mthroughput", "efficiency");
+    for (const ScalingResult& result : results) {
+        std::printf("%-44s %10.2f ", result.key().c_str(), result.frame_ms);
+        if (result.baseline_ms > 0) {
+            std::printf("%10.2f ", result.baseline_ms);
+        } else {
+            std::printf("%10s ", "-");
+        }
+        std::printf("%12.2f %9.0f%%%s\n", result.throughput / 1e6, 100 * result.efficiency,
+                    result.regression ? "  REGRESSION" : "");
+    }
+
+    if (!csv_path.empty() && !write_csv(csv_path, results)) {
+        std::fprintf(stderr, "failed to write %s\n", csv_path.c_str());
+        return 1;
+    }
+    if (!json_path.empty() && !write_json(json_path, results, !baseline_path.empty())) {
+        std::fprintf(stderr, "failed to write %s\n", json_path.c_str());
+        return 1;
+    }
+    if (regressions > 0) {
+        std::printf("%d of %d cases are more than %.0f%% slower than the baseline\n", regressions,
+                    (int)results.size(), 100 * tolerance);
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include "cpu_features.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPU_X86 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#ifdef CPU_X86
+
+static void cpuid(int leaf, int subleaf, unsigned registers[4]) {
+#ifdef _MSC_VER
+    int values[4];
+    __cpuidex(values, leaf, subleaf);
+    for (int i = 0; i < 4; i++) {
+        registers[i] = (unsigned)values[i];
+    }
+#else
+    __cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+}
+
+// Register state the OS saves on context switches (XCR0)
+static unsigned long long enabled_state() {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned low, high;
+    __asm__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+    return ((unsigned long long)high << 32) | low;
+#endif
+}
+
+static SimdIsa detect_isa() {
+    unsigned registers[4];
+    cpuid(0, 0, registers);
+    unsigned max_leaf = registers[0];
+    if (max_leaf < 7) {
+        return IsaBaseline;
+    }
+    cpuid(1, 0, registers);
+    bool osxsave = registers[2] & (1u << 27);
+    bool avx = registers[2] & (1u << 28);
+    if (!osxsave || !avx) {
+        return IsaBaseline;
+    }
+    unsigned long long state = enabled_state();
+    bool ymm_state = (state & 0x6) == 0x6;    // SSE and AVX registers
+    bool zmm_state = (state & 0xe0) == 0xe0;  // opmask and both halves of the AVX-512 registers
+    cpuid(7, 0, registers);
+    bool avx2 = registers[1] & (1u << 5);
+    bool avx512f = registers[1] & (1u << 16);
+    if (ymm_state && zmm_state && avx2 && avx512f) {
+        return IsaAVX512;
+    }
+    if (ymm_state && avx2) {
+        return IsaAVX2;
+    }
+    return IsaBaseline;
+}
+
+#else
+
+static SimdIsa detect_isa() {
+    return IsaBaseline;
+}
+
+#endif
+
+SimdIsa cpu_isa() {
+    static const SimdIsa isa = detect_isa();
+    return isa;
+}
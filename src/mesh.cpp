@@ -0,0 +1,59 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "mesh.h"
+
+std::vector<std::string> split(const std::string& line, char delimiter) {
+    std::vector<std::string> result;
+    size_t i = 0;
+    size_t j = 0;
+    while (j < line.size()) {
+        if (line[j] == delimiter) {
+            if (i != j) {
+                result.push_back(line.substr(i, j - i));
+            }
+            j++;
+            i = j;
+            continue;
+        }
+        j++;
+    }
+    if (i != j) {
+        result.push_back(line.substr(i, j - i));
+    }
+
+    return result;
+}
+
+Mesh load_mesh(const std::string& mesh_file) {
+    // TODO(Ben): should only support triangles, so potentially split quad faces into triangles
+    std::ifstream file(mesh_file);
+    Mesh mesh;
+    if (!file.is_open()) {
+        std::cout << "Failed to open " << mesh_file << std::endl;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        std::vector<std::string> split_line = split(line);
+        if (split_line.size() == 0) {
+            continue;
+        }
+        if (split_line[0] == "v") {
+            Vec3 vertex;
+            vertex.x = std::stod(split_line[1]);
+            vertex.y = std::stod(split_line[2]);
+            vertex.z = std::stod(split_line[3]);
+            mesh.vertices.push_back(vertex);
+        } else if (split_line[0] == "f") {
+            std::vector<int> face;
+            for (size_t i = 1; i < split_line.size(); i++) {
+                face.push_back(std::stoi(split(split_line[i], '/')[0]) - 1);
+            }
+            mesh.faces.push_back(face);
+        } else {
+            continue;
+        }
+    }
+    return mesh;
+}
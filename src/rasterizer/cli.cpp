@@ -0,0 +1,152 @@
+// Rasterizes OBJ models along a camera path without a window and reports throughput. Meant for
+// benchmarking on headless machines.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "raster_kernels.h"
+#include "rasterizer.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+constexpr double pi = 3.141592653589793238462643383;
+
+static void print_usage() {
+    std::printf(
+        "usage: rasterizer-cli --mesh FILE [--mesh FILE ...] [options]\n"
+        "  --frames N         frames along the path, default 60\n"
+        "  --distance D       camera distance from the models' center, default 10\n"
+        "  --output DIR       write every frame to DIR/frame_NNNN.png (or .ppm with --ppm)\n"
+        "  --ppm              write PPM instead of PNG\n"
+        "  --threads N        render threads, default one per hardware thread\n"
+        "  --isa NAME         SIMD kernels to use, one of %s, default: the best this CPU runs\n"
+        "  --no-hiz           depth test every pixel, without the per tile and block max depth\n"
+        "  --quiet            only print the summary\n"
+        "The camera circles the models once, always looking at their center. Output is %dx%d.\n",
+        available_raster_kernels(), width, height);
+}
+
+static bool write_frame(const std::string& path, const Color* framebuffer, bool ppm) {
+    if (!ppm) {
+        return stbi_write_png(path.c_str(), width, height, 3, framebuffer, width * (int)sizeof(Color)) != 0;
+    }
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    std::fprintf(file, "P6\n%d %d\n255\n", width, height);
+    std::fwrite(framebuffer, sizeof(Color), width * height, file);
+    return std::fclose(file) == 0;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> mesh_files;
+    int frame_count = 60;
+    double distance = 10;
+    std::string output_dir;
+    bool ppm = false;
+    bool quiet = false;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(arg, "--mesh") == 0 && has_value) {
+            mesh_files.push_back(argv[++i]);
+        } else if (std::strcmp(arg, "--frames") == 0 && has_value) {
+            frame_count = std::atoi(argv[++i]);
+        } else if (std::strcmp(arg, "--distance") == 0 && has_value) {
+            distance = std::atof(argv[++i]);
+        } else if (std::strcmp(arg, "--output") == 0 && has_value) {
+            output_dir = argv[++i];
+        } else if (std::strcmp(arg, "--threads") == 0 && has_value) {
+            raster_thread_count = std::atoi(argv[++i]);
+        } else if (std::strcmp(arg, "--isa") == 0 && has_value) {
+            const char* isa = argv[++i];
+            if (!select_raster_kernels(isa)) {
+                std::fprintf(stderr, "no %s kernels in this build or this CPU can't run them (built: %s)\n", isa,
+                             available_raster_kernels());
+                return 1;
+            }
+        } else if (std::strcmp(arg, "--no-hiz") == 0) {
+            raster_hierarchical_z = false;
+        } else if (std::strcmp(arg, "--ppm") == 0) {
+            ppm = true;
+        } else if (std::strcmp(arg, "--quiet") == 0) {
+            quiet = true;
+        } else {
+            print_usage();
+            return std::strcmp(arg, "--help") == 0 ? 0 : 1;
+        }
+    }
+    if (mesh_files.empty() || frame_count < 1) {
+        print_usage();
+        return 1;
+    }
+
+    std::vector<Model> models(mesh_files.size());
+    Vec3 center(0, 0, 0);
+    int vertex_count = 0;
+    for (size_t i = 0; i < mesh_files.size(); i++) {
+        models[i].mesh = load_mesh(mesh_files[i]);
+        models[i].position = Vec3(0, 0, 0);
+        if (models[i].mesh.faces.empty()) {
+            std::fprintf(stderr, "no faces in %s\n", mesh_files[i].c_str());
+            return 1;
+        }
+        for (const Vec3& vertex : models[i].mesh.vertices) {
+            center = center + vertex;
+            vertex_count++;
+        }
+    }
+    center = center / std::max(vertex_count, 1);
+
+    std::vector<Color> framebuffer(width * height);
+    double total_ms = 0;
+    long long total_triangles = 0;
+    long long total_pixels = 0;
+    long long total_triangles_rejected = 0;
+    long long total_pixels_rejected = 0;
+    for (int frame = 0; frame < frame_count; frame++) {
+        double angle = 2 * pi * frame / frame_count;
+        Camera camera;
+        camera.position = center + distance * Vec3(std::sin(angle), 0, std::cos(angle));
+        camera.direction = normalize(center - camera.position);
+        render(framebuffer.data(), camera, models.data(), (int)models.size());
+
+        total_ms += raster_stats.frame_ms;
+        total_triangles += raster_stats.triangle_count;
+        total_pixels += raster_stats.pixels_written;
+        total_triangles_rejected += raster_stats.triangles_rejected;
+        total_pixels_rejected += raster_stats.pixels_rejected;
+        if (!quiet) {
+            std::printf("frame %d: %.2f ms, %lld triangles (%lld drawn), %.2f Mtris/s, %.2f Mpixels/s, "
+                        "hierarchical z rejected %lld triangles, %lld pixels\n",
+                        frame, raster_stats.frame_ms, raster_stats.triangle_count, raster_stats.triangles_drawn,
+                        raster_stats.triangle_count / (raster_stats.frame_ms * 1000),
+                        raster_stats.pixels_written / (raster_stats.frame_ms * 1000), raster_stats.triangles_rejected,
+                        raster_stats.pixels_rejected);
+        }
+        if (!output_dir.empty()) {
+            char name[32];
+            std::snprintf(name, sizeof(name), "/frame_%04d.%s", frame, ppm ? "ppm" : "png");
+            if (!write_frame(output_dir + name, framebuffer.data(), ppm)) {
+                std::fprintf(stderr, "failed to write %s%s\n", output_dir.c_str(), name);
+                return 1;
+            }
+        }
+    }
+    std::printf("%d frames on %d threads, %s kernels, mean %.2f ms/frame, %.2f Mtris/s, %.2f Mpixels/s\n",
+                frame_count, raster_thread_count, raster_kernels.isa, total_ms / frame_count,
+                total_triangles / (total_ms * 1000), total_pixels / (total_ms * 1000));
+    if (raster_hierarchical_z) {
+        std::printf("hierarchical z rejected %lld triangles and %lld pixels per frame\n",
+                    total_triangles_rejected / frame_count, total_pixels_rejected / frame_count);
+    }
+    return 0;
+}
@@ -9,6 +9,7 @@
 #include <fstream>
 #include <algorithm>
 
+#include "raster_kernels.h"
 #include "rasterizer.h"
 
 #include "imgui.h"
@@ -305,6 +306,20 @@ int main() {
 
             }
 
+            ImGui::Separator();
+            ImGui::InputInt("Threads", &raster_thread_count);
+            if (raster_thread_count < 1) {
+                raster_thread_count = 1;
+            }
+            ImGui::Checkbox("Hierarchical Z", &raster_hierarchical_z);
+            ImGui::Text("Frame: %.2f ms, %lld of %lld triangles drawn", raster_stats.frame_ms,
+                        raster_stats.triangles_drawn, raster_stats.triangle_count);
+            if (raster_hierarchical_z) {
+                ImGui::Text("Rejected early: %lld triangles, %lld pixels", raster_stats.triangles_rejected,
+                            raster_stats.pixels_rejected);
+            }
+            ImGui::Text("SIMD kernels: %s (%d wide)", raster_kernels.isa, raster_kernels.simd_width);
+
             ImGui::End();
         }
 
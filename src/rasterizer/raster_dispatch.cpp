@@ -0,0 +1,43 @@
+#include "raster_kernels.h"
+#include "cpu_features.h"
+
+// One table per copy of raster_kernels.cpp in the build, see CMakeLists.txt
+namespace raster_kernels_baseline {
+extern const RasterKernels raster_kernels;
+}
+#ifdef RASTERIZER_KERNELS_AVX2
+namespace raster_kernels_avx2 {
+extern const RasterKernels raster_kernels;
+}
+#endif
+#ifdef RASTERIZER_KERNELS_AVX512
+namespace raster_kernels_avx512 {
+extern const RasterKernels raster_kernels;
+}
+#endif
+
+// lowest level first
+static const KernelVariant<RasterKernels> variants[] = {
+    {IsaBaseline, &raster_kernels_baseline::raster_kernels},
+#ifdef RASTERIZER_KERNELS_AVX2
+    {IsaAVX2, &raster_kernels_avx2::raster_kernels},
+#endif
+#ifdef RASTERIZER_KERNELS_AVX512
+    {IsaAVX512, &raster_kernels_avx512::raster_kernels},
+#endif
+};
+
+// "best" is the widest, a block is 64 pixels and fills even 16 lanes
+static bool best_fits(const RasterKernels&) {
+    return true;
+}
+
+RasterKernels raster_kernels = startup_kernel_variant(variants, best_fits);
+
+bool select_raster_kernels(const char* isa) {
+    return select_kernel_variant(variants, isa, best_fits, raster_kernels);
+}
+
+const char* available_raster_kernels() {
+    return kernel_variant_names(variants);
+}
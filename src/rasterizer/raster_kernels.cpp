@@ -0,0 +1,352 @@
+// Compiled once per instruction set, with KERNEL_NAMESPACE and the compiler flags set by
+// CMakeLists.txt. Keep this file to simd.h and the plain structs of raster_kernels.h.
+#include "simd.h"
+#include "raster_kernels.h"
+
+#ifndef KERNEL_NAMESPACE
+#define KERNEL_NAMESPACE raster_kernels_baseline
+#endif
+
+static_assert(raster_block_pixels % simd_width == 0, "blocks have to fill whole vectors");
+
+namespace KERNEL_NAMESPACE {
+
+constexpr int block_vectors = raster_block_pixels / simd_width;
+
+// Position of every pixel of a block relative to its top left one
+alignas(64) static const float block_offset_x[raster_block_pixels] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7,
+    0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7,
+};
+alignas(64) static const float block_offset_y[raster_block_pixels] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3,
+    4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 5, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 6, 7, 7, 7, 7, 7, 7, 7, 7,
+};
+
+static inline int min_int(int a, int b) { return a < b ? a : b; }
+static inline int max_int(int a, int b) { return a > b ? a : b; }
+
+// Set bits of a lane mask, at most 16 of them
+static inline int count_bits(int mask) {
+    mask = mask - ((mask >> 1) & 0x5555);
+    mask = (mask & 0x3333) + ((mask >> 2) & 0x3333);
+    mask = (mask + (mask >> 4)) & 0x0f0f;
+    return (mask + (mask >> 8)) & 0x1f;
+}
+
+// Depth tests one vector of a block, unless told it passes, and writes the pixels in covered that pass
+static inline int write_pixels(vmask covered, vfloat z, float* depth, unsigned int* color, vint triangle_color,
+                               bool test_depth) {
+    vfloat old_depth = vfloat::load(depth);
+    vmask pass = test_depth ? covered & (z < old_depth) : covered;
+    int passed = bits(pass);
+    if (passed == 0) {
+        return 0;
+    }
+    select(pass, z, old_depth).store(depth);
+    select(pass, triangle_color, vint::load((const int*)color)).store((int*)color);
+    return count_bits(passed);
+}
+
+// Depth of the triangle's plane at pixel (x, y), computed the way the lanes do it below. Every step
+// rounds monotonically in x and y, so over a rectangle of pixels the lanes never go below its value
+// at the corner the plane is nearest at. That's what lets the depth hierarchy reject exactly the
+// pixels that would fail the depth test anyway.
+static inline float plane_depth(const TriangleSetup& triangle, float z_origin, float dz_dx, float dz_dy, int x, int y) {
+    return z_origin + dz_dx * (float)(x - triangle.min_x) + dz_dy * (float)(y - triangle.min_y);
+}
+
+static inline float nearest_depth(const TriangleSetup& triangle, float z_origin, float dz_dx, float dz_dy,
+                                  int min_x, int min_y, int max_x, int max_y) {
+    return plane_depth(triangle, z_origin, dz_dx, dz_dy, dz_dx < 0 ? max_x : min_x, dz_dy < 0 ? max_y : min_y);
+}
+
+static inline float farthest_depth(const TriangleSetup& triangle, float z_origin, float dz_dx, float dz_dy,
+                                   int min_x, int min_y, int max_x, int max_y) {
+    return plane_depth(triangle, z_origin, dz_dx, dz_dy, dz_dx < 0 ? min_x : max_x, dz_dy < 0 ? min_y : max_y);
+}
+
+// Lowers the target's max_depth after the max of a block that held it went down
+static void update_max_depth(const RasterTarget& target) {
+    int blocks = target.blocks_x * ((target.y1 - target.y0 + raster_block_size - 1) / raster_block_size);
+    float old_max = *target.max_depth;
+    float new_max = target.block_max_depth[0];
+    for (int i = 0; i < blocks; i++) {
+        if (target.block_max_depth[i] == old_max) {
+            return; // still held by another block
+        }
+        new_max = target.block_max_depth[i] > new_max ? target.block_max_depth[i] : new_max;
+    }
+    *target.max_depth = new_max;
+}
+
+// Edge functions are tested for a whole block from its corners first, the block being a square and
+// the edges straight: blocks outside an edge are skipped and an edge that a block is wholly inside of
+// is not evaluated per pixel. Only edges that cut through the block are, one vector of pixels at a
+// time in 32 bit lanes. Values inside such a block are at most 14 steps from zero, which the guard
+// band in rasterizer.cpp keeps inside 31 bits. Depth is interpolated in float lanes.
+// With a depth hierarchy (Greene et al., "Hierarchical Z-Buffer Visibility", SIGGRAPH 1993), triangles
+// whose nearest point is behind everything in the target, and blocks whose nearest point is behind
+// everything in the block, are skipped before any per pixel work. Triangles whose farthest point is
+// in front of everything are drawn without testing blocks or pixels.
+static void raster_triangle(const TriangleSetup& triangle, const RasterTarget& target, RasterCounters& counters) {
+    int min_x = max_int(triangle.min_x, target.x0);
+    int min_y = max_int(triangle.min_y, target.y0);
+    int max_x = min_int(triangle.max_x, target.x1 - 1);
+    int max_y = min_int(triangle.max_y, target.y1 - 1);
+    if (min_x > max_x || min_y > max_y) {
+        return;
+    }
+    float z_origin = (float)triangle.z_origin;
+    float dz_dx = (float)triangle.dz_dx;
+    float dz_dy = (float)triangle.dz_dy;
+    float* block_max_depth = target.block_max_depth;
+    float nearest = 0;
+    bool in_front = false;
+    if (block_max_depth) {
+        nearest = nearest_depth(triangle, z_origin, dz_dx, dz_dy, min_x, min_y, max_x, max_y);
+        if (nearest >= *target.max_depth) {
+            counters.triangles_rejected++;
+            counters.pixels_rejected += (long long)(max_x - min_x + 1) * (max_y - min_y + 1);
+            return;
+        }
+        in_front = farthest_depth(triangle, z_origin, dz_dx, dz_dy, min_x, min_y, max_x, max_y) < *target.min_depth;
+        counters.triangles_accepted += in_front;
+    }
+
+    const int last = raster_block_size - 1;
+    int first_block_x = (min_x - target.x0) / raster_block_size;
+    int first_block_y = (min_y - target.y0) / raster_block_size;
+    int last_block_x = (max_x - target.x0) / raster_block_size;
+    int last_block_y = (max_y - target.y0) / raster_block_size;
+
+    // per edge: the step across a block, the lowest and highest value in a block relative to its
+    // top left pixel, and the lanes of one vector relative to its first pixel
+    long long step_x[3], step_y[3], low[3], high[3];
+    alignas(64) int lane_offsets[3][simd_width];
+    for (int e = 0; e < 3; e++) {
+        step_x[e] = triangle.edge_step_x[e];
+        step_y[e] = triangle.edge_step_y[e];
+        low[e] = (step_x[e] < 0 ? step_x[e] * last : 0) + (step_y[e] < 0 ? step_y[e] * last : 0);
+        high[e] = (step_x[e] > 0 ? step_x[e] * last : 0) + (step_y[e] > 0 ? step_y[e] * last : 0);
+        lane_offsets[e][0] = 0;
+        for (int lane = 1; lane < simd_width; lane++) {
+            lane_offsets[e][lane] = lane % raster_block_size ? lane_offsets[e][lane - 1] + triangle.edge_step_x[e]
+                                                             : lane_offsets[e][lane - raster_block_size] + triangle.edge_step_y[e];
+        }
+    }
+    vint lanes[3] = {vint::load(lane_offsets[0]), vint::load(lane_offsets[1]), vint::load(lane_offsets[2])};
+    vint triangle_color = (int)triangle.color;
+
+    bool lowered_max_depth = false;
+    long long pixels_written_before = counters.pixels_written;
+    for (int block_y = first_block_y; block_y <= last_block_y; block_y++) {
+        int y = target.y0 + block_y * raster_block_size;
+        int rows_min_y = max_int(min_y, y);
+        int rows_max_y = min_int(max_y, y + last);
+        // only the vectors holding rows of the bounds, which also keeps the rows past target.y1 out
+        int first_vector = (rows_min_y - y) * raster_block_size / simd_width;
+        int end_vector = ((rows_max_y - y + 1) * raster_block_size + simd_width - 1) / simd_width;
+        vfloat row_offset = (float)(y - triangle.min_y);
+        for (int block_x = first_block_x; block_x <= last_block_x; block_x++) {
+            int x = target.x0 + block_x * raster_block_size;
+            long long corner[3];
+            bool outside = false;
+            int straddling[3];
+            int straddling_count = 0;
+            for (int e = 0; e < 3; e++) {
+                corner[e] = triangle.edge[e] + step_x[e] * (x - triangle.min_x) + step_y[e] * (y - triangle.min_y);
+                if (corner[e] + high[e] < 0) {
+                    outside = true;
+                    break;
+                }
+                if (corner[e] + low[e] < 0) {
+                    straddling[straddling_count++] = e;
+                }
+            }
+            if (outside) {
+                continue;
+            }
+            int block = block_y * target.blocks_x + block_x;
+            if (block_max_depth && !in_front) {
+                int columns_min_x = max_int(min_x, x);
+                int columns_max_x = min_int(max_x, x + last);
+                if (nearest_depth(triangle, z_origin, dz_dx, dz_dy, columns_min_x, rows_min_y, columns_max_x,
+                                  rows_max_y) >= block_max_depth[block]) {
+                    counters.pixels_rejected +=
+                        (long long)(columns_max_x - columns_min_x + 1) * (rows_max_y - rows_min_y + 1);
+                    continue;
+                }
+            }
+
+            bool clip_x = x + last >= target.x1;
+            vfloat limit_x = (float)(target.x1 - x);
+            vfloat column_offset = (float)(x - triangle.min_x);
+            float* depth = target.depth + block * raster_block_pixels;
+            unsigned int* color = target.color + block * raster_block_pixels;
+            int written = 0;
+            for (int v = first_vector; v < end_vector; v++) {
+                int first = v * simd_width;
+                vfloat offset_x = vfloat::load(block_offset_x + first);
+                vfloat z = vfloat(z_origin) + vfloat(dz_dx) * (offset_x + column_offset) +
+                           vfloat(dz_dy) * (vfloat::load(block_offset_y + first) + row_offset);
+                vmask covered = offset_x >= vfloat(0.0f); // every lane
+                if (straddling_count > 0) {
+                    vint inside = 0;
+                    for (int s = 0; s < straddling_count; s++) {
+                        int e = straddling[s];
+                        int start = (int)(corner[e] + step_x[e] * (first % raster_block_size) +
+                                          step_y[e] * (first / raster_block_size));
+                        inside = inside | (vint(start) + lanes[e]);
+                    }
+                    covered = nonnegative(inside);
+                }
+                if (clip_x) {
+                    covered = covered & (offset_x < limit_x);
+                }
+                written += write_pixels(covered, z, depth + v * simd_width, color + v * simd_width, triangle_color,
+                                        !in_front);
+            }
+            counters.pixels_written += written;
+
+            if (block_max_depth && written > 0) {
+                // a block the triangle covers whole is no further than the triangle's far corner in it
+                // now, anything else is read back
+                float new_max;
+                if (straddling_count == 0 && !clip_x && first_vector == 0 && end_vector == block_vectors) {
+                    float far = farthest_depth(triangle, z_origin, dz_dx, dz_dy, x, y, x + last, y + last);
+                    new_max = far < block_max_depth[block] ? far : block_max_depth[block];
+                } else {
+                    vfloat block_max = vfloat::load(depth);
+                    for (int v = 1; v < block_vectors; v++) {
+                        block_max = vmax(block_max, vfloat::load(depth + v * simd_width));
+                    }
+                    new_max = reduce_max(block_max);
+                }
+                if (new_max < block_max_depth[block] && block_max_depth[block] == *target.max_depth) {
+                    lowered_max_depth = true;
+                }
+                block_max_depth[block] = new_max;
+            }
+        }
+    }
+    if (lowered_max_depth) {
+        update_max_depth(target);
+    }
+    if (block_max_depth && nearest < *target.min_depth && counters.pixels_written > pixels_written_before) {
+        *target.min_depth = nearest;
+    }
+}
+
+// Index of pixel (target.x0, y) in target's buffers. The row goes on raster_block_pixels further.
+static inline int row_start(const RasterTarget& target, int y) {
+    int dy = y - target.y0;
+    return (dy / raster_block_size * target.blocks_x * raster_block_size + dy % raster_block_size) * raster_block_size;
+}
+
+static inline unsigned long long load_word(const unsigned char* bytes) {
+    unsigned long long word;
+    std::memcpy(&word, bytes, 8);
+    return word;
+}
+
+// Packs a block row of rgb bytes into one color per pixel, from three 64 bit loads
+// NOTE: assumes a little endian CPU
+static inline void pack_colors(const unsigned char* rgb, unsigned int* colors) {
+    unsigned long long words[3] = {load_word(rgb), load_word(rgb + 8), load_word(rgb + 16)};
+    const unsigned long long mask = 0xffffff;
+    colors[0] = words[0] & mask;
+    colors[1] = words[0] >> 24 & mask;
+    colors[2] = (words[0] >> 48 | words[1] << 16) & mask;
+    colors[3] = words[1] >> 8 & mask;
+    colors[4] = words[1] >> 32 & mask;
+    colors[5] = (words[1] >> 56 | words[2] << 8) & mask;
+    colors[6] = words[2] >> 16 & mask;
+    colors[7] = words[2] >> 40;
+}
+
+// The other way round, as three 64 bit stores instead of 24 byte stores
+static inline void unpack_colors(const unsigned int* colors, unsigned char* rgb) {
+    unsigned long long c[8];
+    for (int i = 0; i < 8; i++) {
+        c[i] = colors[i];
+    }
+    unsigned long long words[3] = {
+        c[0] | c[1] << 24 | c[2] << 48,
+        c[2] >> 16 | c[3] << 8 | c[4] << 32 | c[5] << 56,
+        c[5] >> 8 | c[6] << 16 | c[7] << 40,
+    };
+    // one at a time, a wider copy would read them back from the stack
+    for (int i = 0; i < 3; i++) {
+        std::memcpy(rgb + 8 * i, &words[i], 8);
+    }
+}
+
+// A block row of depths, through a local so the compiler needn't check the two for overlap
+static inline void copy_row(const float* from, float* to) {
+    float row[raster_block_size];
+    std::memcpy(row, from, sizeof(row));
+    std::memcpy(to, row, sizeof(row));
+}
+
+static_assert(raster_block_size == 8, "pack_colors() and unpack_colors() do a block row of 8 pixels");
+
+static void load_target(const RasterTarget& target, const float* depth, const unsigned char* rgb, int stride) {
+    // locals, the byte stores could alias target's members
+    float* target_depth = target.depth;
+    unsigned int* target_color = target.color;
+    for (int y = target.y0; y < target.y1; y++) {
+        int index = row_start(target, y);
+        for (int x = target.x0; x < target.x1; x += raster_block_size, index += raster_block_pixels) {
+            int count = min_int(raster_block_size, target.x1 - x);
+            const float* depth_row = depth + y * stride + x;
+            const unsigned char* pixels = rgb + 3 * (y * stride + x);
+            if (count == raster_block_size) {
+                copy_row(depth_row, &target_depth[index]);
+                pack_colors(pixels, &target_color[index]);
+                continue;
+            }
+            for (int i = 0; i < count; i++) {
+                target_depth[index + i] = depth_row[i];
+                target_color[index + i] = pixels[3 * i] | (unsigned int)pixels[3 * i + 1] << 8 |
+                                          (unsigned int)pixels[3 * i + 2] << 16;
+            }
+        }
+    }
+}
+
+static void store_target(const RasterTarget& target, float* depth, unsigned char* rgb, int stride) {
+    // locals, the byte stores could alias target's members
+    float* target_depth = target.depth;
+    unsigned int* target_color = target.color;
+    for (int y = target.y0; y < target.y1; y++) {
+        int index = row_start(target, y);
+        for (int x = target.x0; x < target.x1; x += raster_block_size, index += raster_block_pixels) {
+            int count = min_int(raster_block_size, target.x1 - x);
+            float* depth_row = depth + y * stride + x;
+            unsigned char* pixels = rgb + 3 * (y * stride + x);
+            if (count == raster_block_size) {
+                copy_row(&target_depth[index], depth_row);
+                unpack_colors(&target_color[index], pixels);
+                continue;
+            }
+            for (int i = 0; i < count; i++) {
+                unsigned int color = target_color[index + i];
+                depth_row[i] = target_depth[index + i];
+                pixels[3 * i] = color & 0xff;
+                pixels[3 * i + 1] = (color >> 8) & 0xff;
+                pixels[3 * i + 2] = (color >> 16) & 0xff;
+            }
+        }
+    }
+}
+
+extern const RasterKernels raster_kernels = {
+    SIMD_ISA_NAME,
+    simd_width,
+    raster_triangle,
+    load_target,
+    store_target,
+};
+
+} // namespace KERNEL_NAMESPACE
@@ -0,0 +1,70 @@
+#ifndef RASTER_KERNELS_H
+#define RASTER_KERNELS_H
+
+// The rasterizer's SIMD kernels. Like the raytracer's (src/raytracer/kernels.h), raster_kernels.cpp
+// is compiled once per instruction set the build targets, and `raster_kernels` points at the widest
+// copy this CPU runs. The same NOTE applies: the kernels only see the plain structs below.
+
+// Triangles are rasterized in square blocks of this many pixels, each block a few vectors
+constexpr int raster_block_size = 8;
+constexpr int raster_block_pixels = raster_block_size * raster_block_size;
+
+// A triangle snapped and set up by setup_triangle() in rasterizer.cpp
+struct TriangleSetup {
+    // Edge functions at the center of pixel (min_x, min_y) and their steps per pixel. Edge i is the
+    // one across from corner i, its value over twice the area is that corner's weight. The top-left
+    // rule is folded in, a pixel is covered when all three are >= 0.
+    long long edge[3];
+    int edge_step_x[3];
+    int edge_step_y[3];
+    int min_x, min_y, max_x, max_y; // pixels whose center is inside the bounds, clamped to the screen
+    double z_origin; // depth at the center of pixel (min_x, min_y)
+    double dz_dx, dz_dy;
+    unsigned int color; // red in the low byte, then green and blue
+};
+
+// Pixels [x0, x1) x [y0, y1) of the screen, in buffers that store them block by block: block (bx, by)
+// from (x0, y0) starts at (by * blocks_x + bx) * raster_block_pixels and holds its pixels row by row.
+// Buffers are 64 byte aligned and hold whole blocks, kernels may write all of a block's pixels.
+struct RasterTarget {
+    int x0, y0, x1, y1;
+    int blocks_x;
+    float* depth;
+    unsigned int* color;
+    // Depth hierarchy, or nullptr to test every pixel: the largest depth in every block, the largest
+    // of those and a bound no pixel is nearer than. Kernels keep them up to date. Pixels of a block
+    // past x1 or y1 have to hold -infinity so they don't count.
+    float* block_max_depth;
+    float* max_depth;
+    float* min_depth;
+};
+
+// Summed over raster_triangle() calls
+struct RasterCounters {
+    long long pixels_written;     // pixels that passed the depth test
+    long long triangles_rejected; // calls the depth hierarchy skipped whole
+    long long triangles_accepted; // calls it found in front of everything, drawn without depth tests
+    long long pixels_rejected;    // pixels of the triangles' bounds it skipped, in those calls or by block
+};
+
+struct RasterKernels {
+    const char* isa; // instruction set this copy was compiled for
+    int simd_width;
+    // Depth tests and writes the pixels of triangle inside target
+    void (*raster_triangle)(const TriangleSetup& triangle, const RasterTarget& target, RasterCounters& counters);
+    // Copy target's pixels from a screen sized depth buffer and rgb framebuffer, stride pixels per
+    // row, into target's buffers, and back
+    void (*load_target)(const RasterTarget& target, const float* depth, const unsigned char* rgb, int stride);
+    void (*store_target)(const RasterTarget& target, float* depth, unsigned char* rgb, int stride);
+};
+
+extern RasterKernels raster_kernels;
+
+// Switches to the copy compiled for isa ("sse2", "avx2", "avx512", or "best"). Returns false and
+// keeps the current one if this build has no such copy or the CPU can't run it.
+// The RENDER_ISA environment variable does the same at startup.
+bool select_raster_kernels(const char* isa);
+// Instruction sets of the copies in this build, comma separated
+const char* available_raster_kernels();
+
+#endif // !RASTER_KERNELS_H
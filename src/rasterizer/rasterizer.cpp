@@ -1,59 +1,236 @@
 #include <algorithm>
+#include <chrono>
 #include <cmath>
-#include <fstream>
-#include <iostream>
 #include <string>
+#include <vector>
 
 #include "rasterizer.h"
+#include "raster_kernels.h"
 #include "render.h"
+#include "simd.h"
+#include "thread_pool.h"
 
 float z_buffer[width * height];
+RasterStats raster_stats;
+int raster_thread_count = hardware_thread_count();
+bool raster_hierarchical_z = true;
+
+static ThreadPool pool;
 
 Vec3 barycentric(Vec3 v0, Vec3 v1, Vec3 v2, Vec3 p) {
-    Vec3 edge0 = Vec3(v2.x - v0.x, v1.x - v0.x, v0.x - p.x);
-    Vec3 edge1 = Vec3(v2.y - v0.y, v1.y - v0.y, v0.y - p.y);
-    Vec3 u = cross(edge0, edge1);
-    if (std::abs(u.z) < 1) {
+    // cross((v2 - v0, v1 - v0, v0 - p).x, (...).y), in scalars since the inputs are gathered
+    // across lanes and packing them for the SIMD cross() costs more than it saves
+    real e0x = v2.x - v0.x, e0y = v1.x - v0.x, e0z = v0.x - p.x;
+    real e1x = v2.y - v0.y, e1y = v1.y - v0.y, e1z = v0.y - p.y;
+    real ux = e0y * e1z - e0z * e1y;
+    real uy = e0z * e1x - e0x * e1z;
+    real uz = e0x * e1y - e0y * e1x;
+    if (std::abs(uz) < 1) {
         return Vec3(-1, -1, -1);
     }
-    return Vec3(1.0 - (u.x + u.y) / u.z, u.y / u.z, u.x / u.z);
+    return Vec3(1.0 - (ux + uy) / uz, uy / uz, ux / uz);
+}
+
+// Screen positions are snapped to 28.4 fixed point, 1/16 of a pixel
+constexpr int subpixel_bits = 4;
+constexpr int subpixel_scale = 1 << subpixel_bits;
+// Triangles with a corner further out than this many pixels are dropped. That keeps the edge
+// functions well inside 64 bits, and inside 32 bits over any block an edge cuts through, which is
+// where the kernels evaluate them per pixel (raster_kernels.cpp). Nothing is clipped, so those
+// were garbage anyway.
+constexpr real guard_band = 1 << 17;
+
+// Nearest subpixel, halves away from zero like std::lround() but without the library call
+static inline long long snap(real v) {
+    double scaled = (double)v * subpixel_scale;
+    return (long long)(scaled + (scaled < 0 ? -0.5 : 0.5));
+}
+
+// The kernels' color layout, see TriangleSetup::color. They read and write the framebuffer as rgb
+// bytes.
+static_assert(sizeof(Color) == 3, "Color has to be packed bytes");
+static inline unsigned int pack_color(Color color) {
+    return color.r | (unsigned int)color.g << 8 | (unsigned int)color.b << 16;
 }
 
-void sweep_triangle(Color* framebuffer, Vec3 v0, Vec3 v1, Vec3 v2, Color color) {
-    Vec2 bboxmin;
-    Vec2 bboxmax;
-    bboxmin.x = std::min(v0.x, std::min(v1.x, v2.x));
-    bboxmin.y = std::min(v0.y, std::min(v1.y, v2.y));
-    bboxmax.x = std::max(v0.x, std::max(v1.x, v2.x));
-    bboxmax.y = std::max(v0.y, std::max(v1.y, v2.y));
-
-    bboxmin.x = std::max(0.0, std::min(width - 1.0, bboxmin.x));
-    bboxmin.y = std::max(0.0, std::min(height - 1.0, bboxmin.y));
-    bboxmax.x = std::min(width - 1.0, std::max(0.0, bboxmax.x));
-    bboxmax.y = std::min(height - 1.0, std::max(0.0, bboxmax.y));
-
-    for (int x = bboxmin.x; x < bboxmax.x; x++) {
-        for (int y = bboxmin.y; y < bboxmax.y; y++) {
-            Vec3 barycentric_coords = barycentric(v0, v1, v2, Vec3(x, y, 0));
-            if (barycentric_coords.x < 0 || barycentric_coords.y < 0 || barycentric_coords.z < 0) {
+// Half-space rasterizer after Pineda, "A Parallel Algorithm for Polygon Rasterization" (SIGGRAPH
+// 1988). An edge function is twice the signed area of the triangle an edge makes with a pixel's
+// center, so it is linear in x and y: after one setup per triangle, raster_kernels.raster_triangle()
+// evaluates it for a block of pixels with a few vector adds. On snapped corners it is exact in
+// integers, so triangles sharing an edge agree on it and the top-left rule (as in Direct3D) gives
+// every pixel center on the edge to exactly one of them.
+// Returns false for triangles that cover no pixel centers on screen.
+static bool setup_triangle(Vec3 v0, Vec3 v1, Vec3 v2, Color color, TriangleSetup& setup) {
+    for (const Vec3* v : {&v0, &v1, &v2}) {
+        if (!(std::abs(v->x) <= guard_band && std::abs(v->y) <= guard_band)) {
+            return false;
+        }
+    }
+    long long x0 = snap(v0.x), y0 = snap(v0.y);
+    long long x1 = snap(v1.x), y1 = snap(v1.y);
+    long long x2 = snap(v2.x), y2 = snap(v2.y);
+    long long area = (x1 - x0) * (y2 - y0) - (y1 - y0) * (x2 - x0);
+    if (area == 0) {
+        return false;
+    }
+    if (area < 0) {
+        std::swap(x1, x2);
+        std::swap(y1, y2);
+        std::swap(v1.z, v2.z);
+        area = -area;
+    }
+
+    // pixels whose center (x + 0.5, y + 0.5) is inside the bounds, clamped to the screen
+    const long long half = subpixel_scale / 2;
+    int min_x = std::max<long long>(0, (std::min(x0, std::min(x1, x2)) - half + subpixel_scale - 1) >> subpixel_bits);
+    int min_y = std::max<long long>(0, (std::min(y0, std::min(y1, y2)) - half + subpixel_scale - 1) >> subpixel_bits);
+    int max_x = std::min<long long>(width - 1, (std::max(x0, std::max(x1, x2)) - half) >> subpixel_bits);
+    int max_y = std::min<long long>(height - 1, (std::max(y0, std::max(y1, y2)) - half) >> subpixel_bits);
+    if (min_x > max_x || min_y > max_y) {
+        return false;
+    }
+
+    // edge 0 runs v1 -> v2, edge 1 v2 -> v0 and edge 2 v0 -> v1. Steps are per subpixel until the end.
+    long long step_x0 = y1 - y2, step_y0 = x2 - x1;
+    long long step_x1 = y2 - y0, step_y1 = x0 - x2;
+    long long step_x2 = y0 - y1, step_y2 = x1 - x0;
+    long long center_x = ((long long)min_x << subpixel_bits) + half;
+    long long center_y = ((long long)min_y << subpixel_bits) + half;
+    long long w0 = step_x0 * (center_x - x1) + step_y0 * (center_y - y1);
+    long long w1 = step_x1 * (center_x - x2) + step_y1 * (center_y - y2);
+    long long w2 = step_x2 * (center_x - x0) + step_y2 * (center_y - y0);
+
+    // depth is a plane over the screen, z = z_origin + dz_dx * (x - min_x) + dz_dy * (y - min_y)
+    double inverse_area = (double)subpixel_scale / area;
+    setup.dz_dx = (v0.z * step_x0 + v1.z * step_x1 + v2.z * step_x2) * inverse_area;
+    setup.dz_dy = (v0.z * step_y0 + v1.z * step_y1 + v2.z * step_y2) * inverse_area;
+    setup.z_origin = (v0.z * w0 + v1.z * w1 + v2.z * w2) * (inverse_area / subpixel_scale);
+
+    // Top-left rule: centers exactly on an edge are inside only for top edges (horizontal, with the
+    // triangle below) and left edges (the triangle to their right). With y down and the corners
+    // ordered as above, those are the edges going up, or going right on a horizontal one. The
+    // others need w > 0, which is w - 1 >= 0 in integers.
+    auto bias = [](long long step_x, long long step_y) {
+        return step_x > 0 || (step_x == 0 && step_y > 0) ? 0 : -1;
+    };
+    setup.edge[0] = w0 + bias(step_x0, step_y0);
+    setup.edge[1] = w1 + bias(step_x1, step_y1);
+    setup.edge[2] = w2 + bias(step_x2, step_y2);
+    // the guard band keeps these within 30 bits
+    setup.edge_step_x[0] = (int)(step_x0 << subpixel_bits);
+    setup.edge_step_x[1] = (int)(step_x1 << subpixel_bits);
+    setup.edge_step_x[2] = (int)(step_x2 << subpixel_bits);
+    setup.edge_step_y[0] = (int)(step_y0 << subpixel_bits);
+    setup.edge_step_y[1] = (int)(step_y1 << subpixel_bits);
+    setup.edge_step_y[2] = (int)(step_y2 << subpixel_bits);
+    setup.min_x = min_x;
+    setup.min_y = min_y;
+    setup.max_x = max_x;
+    setup.max_y = max_y;
+    setup.color = pack_color(color);
+    return true;
+}
+
+// Sets the depth of the pixels past x1 or y1 in target's blocks to -infinity, see RasterTarget,
+// and the max depth of blocks with no pixels before x1 and y1 with it
+static void fence_target(const RasterTarget& target) {
+    int blocks_y = (target.y1 - target.y0 + raster_block_size - 1) / raster_block_size;
+    for (int block_y = 0; block_y < blocks_y; block_y++) {
+        int rows = std::min(raster_block_size, target.y1 - target.y0 - block_y * raster_block_size);
+        for (int block_x = 0; block_x < target.blocks_x; block_x++) {
+            int columns = std::max(0, std::min(raster_block_size, target.x1 - target.x0 - block_x * raster_block_size));
+            if (rows == raster_block_size && columns == raster_block_size) {
                 continue;
             }
-            double z = v0.z * barycentric_coords.x + v1.z * barycentric_coords.y + v2.z * barycentric_coords.z;
-            if (z < z_buffer[y * width + x]) {
-                z_buffer[y * width + x] = z;
-                framebuffer[y * width + x] = color;
+            int block = block_y * target.blocks_x + block_x;
+            float* depth = &target.depth[block * raster_block_pixels];
+            for (int row = 0; row < raster_block_size; row++) {
+                int inside = row < rows ? columns : 0;
+                std::fill(depth + row * raster_block_size + inside, depth + (row + 1) * raster_block_size, -INFINITY);
+            }
+            if (columns == 0 && target.block_max_depth) {
+                target.block_max_depth[block] = -INFINITY;
             }
         }
     }
 }
 
-void render(Color* framebuffer, const Camera& camera, Model models[], int model_count) {
-    // NOTE(Ben): weird white artifacts/pixels near mesh edges
-    // I dont think so anymore - Justin
-    for (int i = 0; i < width * height; i++) {
-        z_buffer[i] = INFINITY;
-        framebuffer[i] = Color(0, 0, 0);
+static aligned_floats sweep_depth;
+static std::vector<unsigned int, AlignedAllocator<unsigned int>> sweep_color;
+
+int sweep_triangle(Color* framebuffer, Vec3 v0, Vec3 v1, Vec3 v2, Color color) {
+    TriangleSetup setup;
+    if (!setup_triangle(v0, v1, v2, color, setup)) {
+        return 0;
     }
+    // the kernels work on whole blocks, so the triangle's bounds are copied out and back
+    RasterTarget target;
+    target.x0 = setup.min_x / raster_block_size * raster_block_size;
+    target.y0 = setup.min_y / raster_block_size * raster_block_size;
+    target.x1 = setup.max_x + 1;
+    target.y1 = setup.max_y + 1;
+    target.blocks_x = (target.x1 - target.x0 + raster_block_size - 1) / raster_block_size;
+    int blocks_y = (target.y1 - target.y0 + raster_block_size - 1) / raster_block_size;
+    sweep_depth.resize(target.blocks_x * blocks_y * raster_block_pixels);
+    sweep_color.resize(sweep_depth.size());
+    target.depth = sweep_depth.data();
+    target.color = sweep_color.data();
+    // no depth hierarchy, building one for the bounds would cost as much as the tests it could save
+    target.block_max_depth = nullptr;
+    target.max_depth = nullptr;
+    target.min_depth = nullptr;
+    raster_kernels.load_target(target, z_buffer, &framebuffer[0].r, width);
+    RasterCounters counters = {};
+    raster_kernels.raster_triangle(setup, target, counters);
+    raster_kernels.store_target(target, z_buffer, &framebuffer[0].r, width);
+    return (int)counters.pixels_written;
+}
+
+// Sort-middle rendering (Molnar et al., "A Sorting Classification of Parallel Rendering", 1994):
+// the geometry stage sets up triangles and sorts them into the screen tiles they touch, then every
+// tile is rasterized as one job in a buffer of its own that stays in cache, and copied out once.
+// Nothing is shared between jobs of a stage, so neither stage takes a lock.
+// Geometry runs in chunks of a fixed size and tiles replay their chunks in order, so triangles reach
+// every pixel in submission order and the image doesn't depend on the thread count.
+constexpr int geometry_chunk_size = 4096; // vertices or faces
+constexpr int tiles_x = (width + raster_tile_size - 1) / raster_tile_size;
+constexpr int tiles_y = (height + raster_tile_size - 1) / raster_tile_size;
+
+// What one chunk of faces set up, and its triangles' indices by the tiles they touch
+struct GeometryChunk {
+    std::vector<TriangleSetup> triangles;
+    std::vector<int> bins[tiles_x * tiles_y];
+    long long triangle_count;
+    long long triangles_drawn;
+};
+
+static_assert(raster_tile_size % raster_block_size == 0, "tiles have to hold whole blocks");
+
+constexpr int tile_blocks = raster_tile_size / raster_block_size;
+
+// A tile's pixels block by block and its depth hierarchy, see RasterTarget
+struct TileBuffer {
+    alignas(64) float depth[raster_tile_size * raster_tile_size];
+    alignas(64) unsigned int color[raster_tile_size * raster_tile_size];
+    float block_max_depth[tile_blocks * tile_blocks];
+    float max_depth;
+    float min_depth;
+};
+
+static std::vector<Vec3> screen_coords;     // every model's vertices, one model after the other
+static std::vector<long long> vertex_starts; // where each model's vertices start, then the total
+static std::vector<long long> face_starts;
+static std::vector<Mat4> model_view_projections;
+static std::vector<std::vector<Vec4>> clip_scratch; // per worker
+static std::vector<GeometryChunk> geometry_chunks;
+static std::vector<TileBuffer> tile_buffers;        // per worker
+static RasterCounters tile_counters[tiles_x * tiles_y];
+
+void render(Color* framebuffer, const Camera& camera, const Model models[], int model_count) {
+    auto frame_start = std::chrono::steady_clock::now();
+    pool.resize(raster_thread_count);
+    raster_thread_count = pool.size();
+
     double tangent = tan(45.0 / 2.0 * (3.1415926535 / 180));
     double top = 0.1 * tangent;
     double right = top * aspect_ratio;
@@ -68,86 +245,147 @@ void render(Color* framebuffer, const Camera& camera, Model models[], int model_
 
     Mat4 view = look_at(camera.position, camera.position + camera.direction, Vec3(0, 1, 0));
 
+    vertex_starts.assign(1, 0);
+    face_starts.assign(1, 0);
+    model_view_projections.resize(model_count);
     for (int i = 0; i < model_count; i++) {
-        Model model = models[i];
-        Mesh mesh = model.mesh;
-        Mat4 model_mat = translate(model.position);
-
-        for (int i = 0; i < mesh.faces.size(); i++) {
-            const std::vector<int>& face = mesh.faces[i];
-            Vec3 screen_coords[3];
-            Vec3 triangle[3];
-            for (int j = 0; j < face.size(); j++) {
-                Vec3 v = mesh.vertices[face[j]];
-                Vec4 result = projection * (view * (model_mat * Vec4(v.x, v.y, v.z, 1)));
-                Vec3 v1 = Vec3(result.x / result.w, result.y / result.w, result.z / result.w);
-                int x = (v1.x + 1.0) * width  / 2.0;
-                int y = (-v1.y + 1.0) * height / 2.0;
-                screen_coords[j] = Vec3(x, y, v1.z);
-                triangle[j] = v;
+        vertex_starts.push_back(vertex_starts.back() + models[i].mesh.vertices.size());
+        face_starts.push_back(face_starts.back() + models[i].mesh.faces.size());
+        model_view_projections[i] = projection * (view * translate(models[i].position));
+    }
+    long long vertex_count = vertex_starts.back();
+    long long face_count = face_starts.back();
+    screen_coords.resize(vertex_count);
+    clip_scratch.resize(pool.size());
+    tile_buffers.resize(pool.size());
+
+    // every vertex is transformed once per frame and faces look their corners up
+    int vertex_chunks = (int)((vertex_count + geometry_chunk_size - 1) / geometry_chunk_size);
+    pool.parallel_for(vertex_chunks, [&](int chunk, int worker) {
+        long long first = (long long)chunk * geometry_chunk_size;
+        long long last = std::min(first + geometry_chunk_size, vertex_count);
+        int model = std::upper_bound(vertex_starts.begin(), vertex_starts.end(), first) - vertex_starts.begin() - 1;
+        std::vector<Vec4>& clip_coords = clip_scratch[worker];
+        while (first < last) {
+            while (vertex_starts[model + 1] <= first) {
+                model++;
             }
-            Vec3 n = normalize(cross(triangle[2] - triangle[0], triangle[1] - triangle[0]));
-            double light = dot(n, Vec3(0, 0, -1));
-            if (light > 0) {
-                sweep_triangle(framebuffer, screen_coords[0], screen_coords[1], screen_coords[2],
-                               Color(light * 255, light * 255, light * 255));
+            const std::vector<Vec3>& vertices = models[model].mesh.vertices;
+            long long end = std::min(last, vertex_starts[model + 1]);
+            int count = (int)(end - first);
+            long long offset = first - vertex_starts[model];
+            clip_coords.resize(count);
+            for (int j = 0; j < count; j++) {
+                const Vec3& v = vertices[offset + j];
+                clip_coords[j] = Vec4(v.x, v.y, v.z, 1);
             }
+            transform(model_view_projections[model], clip_coords.data(), clip_coords.data(), count);
+            for (int j = 0; j < count; j++) {
+                const Vec4& result = clip_coords[j];
+                Vec3 v1 = Vec3(result.x / result.w, result.y / result.w, result.z / result.w);
+                // sweep_triangle() snaps to subpixels, truncating here would move corners up to a pixel
+                real x = (v1.x + 1.0) * width  / 2.0;
+                real y = (-v1.y + 1.0) * height / 2.0;
+                screen_coords[first + j] = Vec3(x, y, v1.z);
+            }
+            first = end;
         }
-    }
-}
+    });
 
-std::vector<std::string> split(const std::string& line, char delimiter) {
-    std::vector<std::string> result;
-    int i = 0;
-    int j = 0;
-    while (j < line.size()) {
-        if (line[j] == delimiter) {
-            if (i != j) {
-                result.push_back(line.substr(i, j - i));
+    // Faces with more than three corners are drawn as fans, like the raytracer does
+    int face_chunks = (int)((face_count + geometry_chunk_size - 1) / geometry_chunk_size);
+    geometry_chunks.resize(face_chunks);
+    pool.parallel_for(face_chunks, [&](int chunk_index, int) {
+        GeometryChunk& chunk = geometry_chunks[chunk_index];
+        chunk.triangles.clear();
+        for (std::vector<int>& bin : chunk.bins) {
+            bin.clear();
+        }
+        chunk.triangle_count = 0;
+        chunk.triangles_drawn = 0;
+        long long first = (long long)chunk_index * geometry_chunk_size;
+        long long last = std::min(first + geometry_chunk_size, face_count);
+        int model = std::upper_bound(face_starts.begin(), face_starts.end(), first) - face_starts.begin() - 1;
+        for (long long f = first; f < last; f++) {
+            while (face_starts[model + 1] <= f) {
+                model++;
+            }
+            const Mesh& mesh = models[model].mesh;
+            const Vec3* screen = &screen_coords[vertex_starts[model]];
+            const std::vector<int>& face = mesh.faces[f - face_starts[model]];
+            for (int j = 1; j + 1 < (int)face.size(); j++) {
+                const Vec3& v0 = mesh.vertices[face[0]];
+                Vec3 n = normalize(cross(mesh.vertices[face[j + 1]] - v0, mesh.vertices[face[j]] - v0));
+                double light = dot(n, Vec3(0, 0, -1));
+                chunk.triangle_count++;
+                if (light <= 0) {
+                    continue;
+                }
+                chunk.triangles_drawn++;
+                TriangleSetup setup;
+                if (!setup_triangle(screen[face[0]], screen[face[j]], screen[face[j + 1]],
+                                    Color(light * 255, light * 255, light * 255), setup)) {
+                    continue;
+                }
+                int index = (int)chunk.triangles.size();
+                chunk.triangles.push_back(setup);
+                for (int ty = setup.min_y / raster_tile_size; ty <= setup.max_y / raster_tile_size; ty++) {
+                    for (int tx = setup.min_x / raster_tile_size; tx <= setup.max_x / raster_tile_size; tx++) {
+                        chunk.bins[ty * tiles_x + tx].push_back(index);
+                    }
+                }
             }
-            j++;
-            i = j;
-            continue;
         }
-        j++;
-    }
-    if (i != j) {
-        result.push_back(line.substr(i, j - i));
-    }
+    });
 
-    return result;
-}
+    pool.parallel_for(tiles_x * tiles_y, [&](int tile, int worker) {
+        TileBuffer& buffer = tile_buffers[worker];
+        RasterTarget target;
+        target.x0 = tile % tiles_x * raster_tile_size;
+        target.y0 = tile / tiles_x * raster_tile_size;
+        target.x1 = std::min(target.x0 + raster_tile_size, width);
+        target.y1 = std::min(target.y0 + raster_tile_size, height);
+        target.blocks_x = tile_blocks;
+        target.depth = buffer.depth;
+        target.color = buffer.color;
+        target.block_max_depth = raster_hierarchical_z ? buffer.block_max_depth : nullptr;
+        target.max_depth = raster_hierarchical_z ? &buffer.max_depth : nullptr;
+        target.min_depth = raster_hierarchical_z ? &buffer.min_depth : nullptr;
+        std::fill(buffer.depth, buffer.depth + raster_tile_size * raster_tile_size, INFINITY);
+        std::fill(buffer.color, buffer.color + raster_tile_size * raster_tile_size, 0u);
+        std::fill(buffer.block_max_depth, buffer.block_max_depth + tile_blocks * tile_blocks, INFINITY);
+        buffer.max_depth = INFINITY;
+        buffer.min_depth = INFINITY;
+        fence_target(target);
 
-Mesh load_mesh(const std::string& mesh_file) {
-    // TODO(Ben): should only support triangles, so potentially split quad faces into triangles
-    std::ifstream file(mesh_file);
-    Mesh mesh;
-    if (!file.is_open()) {
-        std::cout << "Failed to open " << mesh_file << std::endl;
-    }
-    std::string line;
-    while (std::getline(file, line)) {
-        std::vector<std::string> split_line = split(line);
-        if (split_line.size() == 0) {
-            continue;
-        }
-        if (split_line[0] == "v") {
-            Vec3 vertex;
-            vertex.x = std::stod(split_line[1]);
-            vertex.y = std::stod(split_line[2]);
-            vertex.z = std::stod(split_line[3]);
-            mesh.vertices.push_back(vertex);
-        } else if (split_line[0] == "f") {
-            std::vector<int> face;
-            for (int i = 1; i < split_line.size(); i++) {
-                face.push_back(std::stoi(split(split_line[i], '/')[0]) - 1);
+        RasterCounters& counters = tile_counters[tile];
+        counters = {};
+        for (const GeometryChunk& chunk : geometry_chunks) {
+            for (int index : chunk.bins[tile]) {
+                raster_kernels.raster_triangle(chunk.triangles[index], target, counters);
             }
-            mesh.faces.push_back(face);
-        } else {
-            continue;
         }
+        raster_kernels.store_target(target, z_buffer, &framebuffer[0].r, width);
+    });
+
+    raster_stats.triangle_count = 0;
+    raster_stats.triangles_drawn = 0;
+    raster_stats.pixels_written = 0;
+    raster_stats.triangles_rejected = 0;
+    raster_stats.triangles_accepted = 0;
+    raster_stats.pixels_rejected = 0;
+    for (const GeometryChunk& chunk : geometry_chunks) {
+        raster_stats.triangle_count += chunk.triangle_count;
+        raster_stats.triangles_drawn += chunk.triangles_drawn;
+    }
+    for (const RasterCounters& counters : tile_counters) {
+        raster_stats.pixels_written += counters.pixels_written;
+        raster_stats.triangles_rejected += counters.triangles_rejected;
+        raster_stats.triangles_accepted += counters.triangles_accepted;
+        raster_stats.pixels_rejected += counters.pixels_rejected;
     }
-    return mesh;
+    raster_stats.frame_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - frame_start).count();
 }
 
 Mat4 look_at(Vec3 position, Vec3 target, Vec3 up) {
@@ -2,17 +2,10 @@
 #define RASTERIZER_H
 
 #include "render.h"
-
-#include <vector>
-#include <string>
+#include "mesh.h"
 
 extern float z_buffer[width * height];
 
-struct Mesh {
-    std::vector<Vec3> vertices;
-    std::vector<std::vector<int>> faces;
-};
-
 struct Model {
     Mesh mesh;
     Vec3 position;
@@ -23,10 +16,37 @@ struct Camera {
     Vec3 direction;
 };
 
-void render(Color* framebuffer, const Camera& camera, Model models[], int model_count);
-std::vector<std::string> split(const std::string& line, char delimiter=' ');
-Mesh load_mesh(const std::string& mesh_file);
-void sweep_triangle(Color* framebuffer, Vec3 v0, Vec3 v1, Vec3 v2, Color color);
+// Counters of the last render() call
+struct RasterStats {
+    double frame_ms = 0;
+    long long triangle_count = 0;  // triangles submitted, after splitting faces into fans
+    long long triangles_drawn = 0; // the ones that survived backface culling
+    long long pixels_written = 0;  // pixels that passed the depth test
+    // Skipped by the depth hierarchy before any per pixel work: triangles whose nearest point in a
+    // tile was behind everything in it, once per tile, and the pixels of the triangles' bounds that
+    // were skipped with them or with a block behind everything in it
+    long long triangles_rejected = 0;
+    long long pixels_rejected = 0;
+    long long triangles_accepted = 0; // in front of everything in a tile, drawn without depth tests
+};
+
+extern RasterStats raster_stats;
+// render() bins triangles into square tiles of this many pixels and rasterizes the tiles in parallel
+constexpr int raster_tile_size = 64;
+extern int raster_thread_count; // threads render() uses, every hardware thread by default
+// render() keeps the largest depth of every tile and 8x8 block to skip triangles and blocks that are
+// behind, and the nearest of every tile to skip the depth tests of triangles in front. On by default,
+// the image is the same either way.
+extern bool raster_hierarchical_z;
+
+void render(Color* framebuffer, const Camera& camera, const Model models[], int model_count);
+// Weights of v0, v1, v2 at p (only x and y are used), all negative when the triangle is degenerate
+Vec3 barycentric(Vec3 v0, Vec3 v1, Vec3 v2, Vec3 p);
+// Fills the pixels whose center lies inside the triangle, x and y in pixels with (0, 0) the top left
+// corner of the screen. Corners are snapped to 1/16 pixel and centers on an edge follow the top-left
+// rule, so triangles sharing an edge neither overlap nor leave gaps. Depth is interpolated in float.
+// Returns the number of pixels that passed the depth test
+int sweep_triangle(Color* framebuffer, Vec3 v0, Vec3 v1, Vec3 v2, Color color);
 Mat4 look_at(Vec3 position, Vec3 target, Vec3 up);
 Mat4 translate(Vec3 translation);
 
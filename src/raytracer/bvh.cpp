@@ -0,0 +1,222 @@
+#include "bvh.h"
+
+#include <chrono>
+
+constexpr int bin_count = 16;
+// Cost of visiting a node relative to intersecting one primitive
+constexpr double traversal_cost = 1.0;
+
+static double axis(const Vec3& vec, int index) {
+    return index == 0 ? vec.x : index == 1 ? vec.y : vec.z;
+}
+
+struct Bin {
+    AABB bounds;
+    int count = 0;
+    double cost = 0; // intersection cost of everything in the bin
+};
+
+struct Split {
+    int axis = -1;
+    int bin = 0;
+    double cost = std::numeric_limits<double>::infinity();
+};
+
+// Finds the cheapest split plane between the bins of the centroid bounds, over all three axes.
+static Split find_split(const BVH& bvh, const BVHNode& node, const AABB& centroid_bounds,
+                        const AABB bounds[], const Vec3 centroids[], const double costs[]) {
+    Split best;
+    for (int a = 0; a < 3; a++) {
+        double min = axis(centroid_bounds.min, a);
+        double extent = axis(centroid_bounds.max, a) - min;
+        if (extent <= 0) {
+            continue;
+        }
+        Bin bins[bin_count];
+        double scale = bin_count / extent;
+        for (int i = node.left_first; i < node.left_first + node.count; i++) {
+            int primitive = bvh.indices[i];
+            int b = std::min(bin_count - 1, (int)((axis(centroids[primitive], a) - min) * scale));
+            bins[b].count++;
+            bins[b].cost += costs ? costs[primitive] : 1.0;
+            bins[b].bounds.grow(bounds[primitive]);
+        }
+
+        // sweep from both ends to get the area and count on each side of every plane
+        double left_area[bin_count - 1];
+        int left_count[bin_count - 1];
+        double left_cost[bin_count - 1];
+        AABB left_box;
+        int left_sum = 0;
+        double left_cost_sum = 0;
+        for (int i = 0; i < bin_count - 1; i++) {
+            left_sum += bins[i].count;
+            left_cost_sum += bins[i].cost;
+            left_box.grow(bins[i].bounds);
+            left_count[i] = left_sum;
+            left_cost[i] = left_cost_sum;
+            left_area[i] = left_box.surface_area();
+        }
+        AABB right_box;
+        int right_sum = 0;
+        double right_cost = 0;
+        for (int i = bin_count - 1; i > 0; i--) {
+            right_sum += bins[i].count;
+            right_cost += bins[i].cost;
+            right_box.grow(bins[i].bounds);
+            double cost = left_cost[i - 1] * left_area[i - 1] + right_cost * right_box.surface_area();
+            if (left_count[i - 1] > 0 && right_sum > 0 && cost < best.cost) {
+                best.axis = a;
+                best.bin = i;
+                best.cost = cost;
+            }
+        }
+    }
+    return best;
+}
+
+void build_bvh(BVH& bvh, const AABB bounds[], int count, const double costs[]) {
+    auto start = std::chrono::steady_clock::now();
+
+    bvh.nodes.clear();
+    bvh.indices.resize(count);
+    if (count == 0) {
+        bvh.parents.clear();
+        bvh.leaves.clear();
+        bvh.node_costs.clear();
+        bvh.area_cost = 0;
+        bvh.built_sah_cost = 0;
+        bvh.build_ms = 0;
+        return;
+    }
+    bvh.nodes.reserve(2 * count);
+
+    std::vector<Vec3> centroids(count);
+    for (int i = 0; i < count; i++) {
+        bvh.indices[i] = i;
+        centroids[i] = bounds[i].centroid();
+    }
+
+    BVHNode root;
+    root.left_first = 0;
+    root.count = count;
+    bvh.nodes.push_back(root);
+
+    // nodes still waiting to be split, with their depth
+    std::vector<std::pair<int, int>> stack;
+    stack.push_back({0, 0});
+    while (!stack.empty()) {
+        int node_index = stack.back().first;
+        int depth = stack.back().second;
+        stack.pop_back();
+
+        BVHNode& node = bvh.nodes[node_index];
+        AABB centroid_bounds;
+        double leaf_cost = 0;
+        for (int i = node.left_first; i < node.left_first + node.count; i++) {
+            node.bounds.grow(bounds[bvh.indices[i]]);
+            centroid_bounds.grow(centroids[bvh.indices[i]]);
+            leaf_cost += costs ? costs[bvh.indices[i]] : 1.0;
+        }
+        if (node.count == 1 || depth >= bvh_max_depth) {
+            continue;
+        }
+
+        Split split = find_split(bvh, node, centroid_bounds, bounds, centroids.data(), costs);
+        double split_cost = traversal_cost + split.cost / node.bounds.surface_area();
+
+        int first = node.left_first;
+        int middle;
+        if (split.axis >= 0 && (split_cost < leaf_cost || node.count > bvh_max_leaf_size)) {
+            double min = axis(centroid_bounds.min, split.axis);
+            double scale = bin_count / (axis(centroid_bounds.max, split.axis) - min);
+            int* middle_pointer = std::partition(
+                &bvh.indices[first], &bvh.indices[first] + node.count, [&](int primitive) {
+                    int b = std::min(bin_count - 1, (int)((axis(centroids[primitive], split.axis) - min) * scale));
+                    return b < split.bin;
+                });
+            middle = (int)(middle_pointer - bvh.indices.data());
+        } else if (node.count > bvh_max_leaf_size) {
+            // every centroid is in the same spot, so no plane separates them. Cut the run in half
+            // to keep leaves small.
+            middle = first + node.count / 2;
+        } else {
+            continue;
+        }
+
+        int left = (int)bvh.nodes.size();
+        BVHNode child;
+        child.left_first = first;
+        child.count = middle - first;
+        bvh.nodes.push_back(child);
+        child.left_first = middle;
+        child.count = first + bvh.nodes[node_index].count - middle;
+        bvh.nodes.push_back(child);
+
+        // node may have moved when nodes grew
+        bvh.nodes[node_index].left_first = left;
+        bvh.nodes[node_index].count = 0;
+        stack.push_back({left, depth + 1});
+        stack.push_back({left + 1, depth + 1});
+    }
+
+    bvh.parents.assign(bvh.nodes.size(), -1);
+    bvh.leaves.assign(count, -1);
+    bvh.node_costs.assign(bvh.nodes.size(), traversal_cost);
+    bvh.area_cost = 0;
+    for (int i = 0; i < (int)bvh.nodes.size(); i++) {
+        const BVHNode& node = bvh.nodes[i];
+        if (node.is_leaf()) {
+            bvh.node_costs[i] = 0;
+            for (int j = node.left_first; j < node.left_first + node.count; j++) {
+                bvh.leaves[bvh.indices[j]] = i;
+                bvh.node_costs[i] += costs ? costs[bvh.indices[j]] : 1.0;
+            }
+        } else {
+            bvh.parents[node.left_first] = i;
+            bvh.parents[node.left_first + 1] = i;
+        }
+        bvh.area_cost += node.bounds.surface_area() * bvh.node_costs[i];
+    }
+    bvh.built_sah_cost = sah_cost(bvh);
+
+    bvh.build_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+void refit_bvh(BVH& bvh, const AABB bounds[], const int changed[], int changed_count) {
+    for (int i = 0; i < changed_count; i++) {
+        int node_index = bvh.leaves[changed[i]];
+        while (node_index >= 0) {
+            BVHNode& node = bvh.nodes[node_index];
+            AABB refitted;
+            if (node.is_leaf()) {
+                for (int j = node.left_first; j < node.left_first + node.count; j++) {
+                    refitted.grow(bounds[bvh.indices[j]]);
+                }
+            } else {
+                refitted.grow(bvh.nodes[node.left_first].bounds);
+                refitted.grow(bvh.nodes[node.left_first + 1].bounds);
+            }
+            // nothing above can change either
+            if (refitted.min == node.bounds.min && refitted.max == node.bounds.max) {
+                break;
+            }
+            bvh.area_cost -= node.bounds.surface_area() * bvh.node_costs[node_index];
+            node.bounds = refitted;
+            bvh.area_cost += node.bounds.surface_area() * bvh.node_costs[node_index];
+            node_index = bvh.parents[node_index];
+        }
+    }
+}
+
+double sah_cost(const BVH& bvh) {
+    if (bvh.nodes.empty() || bvh.nodes[0].bounds.surface_area() <= 0) {
+        return 0;
+    }
+    return bvh.area_cost / bvh.nodes[0].bounds.surface_area();
+}
+
+double bvh_quality(const BVH& bvh) {
+    return bvh.built_sah_cost > 0 ? sah_cost(bvh) / bvh.built_sah_cost : 1;
+}
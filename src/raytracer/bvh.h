@@ -0,0 +1,163 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "render.h"
+
+struct AABB {
+    Vec3 min;
+    Vec3 max;
+
+    AABB() : min(std::numeric_limits<real>::infinity(), std::numeric_limits<real>::infinity(),
+                 std::numeric_limits<real>::infinity()),
+             max(-std::numeric_limits<real>::infinity(), -std::numeric_limits<real>::infinity(),
+                 -std::numeric_limits<real>::infinity()) {}
+    AABB(const Vec3& min, const Vec3& max) : min(min), max(max) {}
+
+    void grow(const Vec3& point) {
+        min = Vec3(std::min(min.x, point.x), std::min(min.y, point.y), std::min(min.z, point.z));
+        max = Vec3(std::max(max.x, point.x), std::max(max.y, point.y), std::max(max.z, point.z));
+    }
+
+    void grow(const AABB& box) {
+        grow(box.min);
+        grow(box.max);
+    }
+
+    Vec3 centroid() const {
+        return 0.5 * (min + max);
+    }
+
+    double surface_area() const {
+        Vec3 extent = max - min;
+        if (extent.x < 0) {
+            return 0;
+        }
+        return 2 * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+    }
+};
+
+// Slab test. inverse_direction is 1 / ray.direction, computed once per ray.
+// Returns the distance the ray enters the box at, or infinity on a miss.
+// NOTE: the exit distance is pushed out by the worst case rounding error (Ize, "Robust BVH Ray
+// Traversal", JCGT 2013), otherwise a ray through a point on a box face can miss every box
+// around it and slip between the triangles of a closed mesh. The slab distances are computed in
+// real, so that is the precision the bound is for.
+static double intersect_aabb(const AABB& box, const Vec3& origin, const Vec3& inverse_direction,
+                             double tmin, double tmax) {
+    double tx1 = (box.min.x - origin.x) * inverse_direction.x;
+    double tx2 = (box.max.x - origin.x) * inverse_direction.x;
+    tmin = std::max(tmin, std::min(tx1, tx2));
+    tmax = std::min(tmax, std::max(tx1, tx2));
+    double ty1 = (box.min.y - origin.y) * inverse_direction.y;
+    double ty2 = (box.max.y - origin.y) * inverse_direction.y;
+    tmin = std::max(tmin, std::min(ty1, ty2));
+    tmax = std::min(tmax, std::max(ty1, ty2));
+    double tz1 = (box.min.z - origin.z) * inverse_direction.z;
+    double tz2 = (box.max.z - origin.z) * inverse_direction.z;
+    tmin = std::max(tmin, std::min(tz1, tz2));
+    tmax = std::min(tmax, std::max(tz1, tz2));
+    const double gamma_3 = 3 * std::numeric_limits<real>::epsilon() / 2;
+    return tmin <= tmax * (1 + 2 * gamma_3) ? tmin : std::numeric_limits<double>::infinity();
+}
+
+struct BVHNode {
+    AABB bounds;
+    int left_first; // index of the left child (right child is left_first + 1), or first primitive of a leaf
+    int count;      // number of primitives in a leaf, 0 for interior nodes
+
+    bool is_leaf() const {
+        return count > 0;
+    }
+};
+
+struct BVH {
+    std::vector<BVHNode> nodes; // nodes[0] is the root
+    std::vector<int> indices;   // primitive indices, leaves reference contiguous runs of this
+    std::vector<int> parents;   // node -> parent node, -1 for the root
+    std::vector<int> leaves;    // primitive -> leaf node holding it
+    // node -> what it costs to enter it: a visit (1) or, for a leaf, the costs its primitives were
+    // built with
+    std::vector<double> node_costs;
+    double build_ms = 0;
+    // Sum of surface area * node_costs over all nodes, kept up to date by refit_bvh(). Over the
+    // root's area it is the tree's SAH cost, under the same cost model the build used.
+    double area_cost = 0;
+    double built_sah_cost = 0; // sah_cost() right after the last build
+};
+
+constexpr int bvh_max_depth = 64;
+constexpr int bvh_max_leaf_size = 8;
+
+// Builds a BVH over count primitives with the given bounds, using binned SAH splits. costs are
+// what each primitive costs to intersect relative to a node visit, all 1 when left out.
+void build_bvh(BVH& bvh, const AABB bounds[], int count, const double costs[] = nullptr);
+
+// Moves the leaves holding the changed primitives to their new bounds (bounds has every
+// primitive) and grows or shrinks their ancestors to match. The tree keeps its shape, so it can
+// get a lot worse than a fresh build when primitives move far, see bvh_quality().
+void refit_bvh(BVH& bvh, const AABB bounds[], const int changed[], int changed_count);
+
+// Expected cost of a random ray, by the surface area heuristic
+double sah_cost(const BVH& bvh);
+// sah_cost() over what it was right after the build, 1 for a fresh tree and growing with refits
+double bvh_quality(const BVH& bvh);
+
+// Walks bvh nearest child first and calls leaf(first, count) for every leaf the ray enters before
+// closest. leaf returns true when it found a nearer hit, after lowering closest to it.
+template <typename LeafFunction>
+static bool traverse_bvh(const BVH& bvh, const Vec3& origin, const Vec3& direction,
+                         double tmin, double& closest, LeafFunction leaf) {
+    if (bvh.nodes.empty()) {
+        return false;
+    }
+    const BVHNode* nodes = bvh.nodes.data();
+    Vec3 inverse_direction(1 / direction.x, 1 / direction.y, 1 / direction.z);
+    const double infinity = std::numeric_limits<double>::infinity();
+
+    // nodes still to visit and the distance the ray enters them at
+    struct StackEntry {
+        int node;
+        double t;
+    } stack[bvh_max_depth + 1];
+    int stack_size = 0;
+    bool hit = false;
+    if (intersect_aabb(nodes[0].bounds, origin, inverse_direction, tmin, closest) < infinity) {
+        stack[stack_size++] = {0, tmin};
+    }
+    while (stack_size > 0) {
+        StackEntry entry = stack[--stack_size];
+        // something closer was found since this node was pushed
+        if (entry.t >= closest) {
+            continue;
+        }
+        const BVHNode& node = nodes[entry.node];
+        if (node.is_leaf()) {
+            hit |= leaf(node.left_first, node.count);
+            continue;
+        }
+
+        // push the farther child first so the nearer one is visited next
+        int near_child = node.left_first;
+        int far_child = node.left_first + 1;
+        double t_near = intersect_aabb(nodes[near_child].bounds, origin, inverse_direction, tmin, closest);
+        double t_far = intersect_aabb(nodes[far_child].bounds, origin, inverse_direction, tmin, closest);
+        if (t_far < t_near) {
+            std::swap(near_child, far_child);
+            std::swap(t_near, t_far);
+        }
+        if (t_far < infinity) {
+            stack[stack_size++] = {far_child, t_far};
+        }
+        if (t_near < infinity) {
+            stack[stack_size++] = {near_child, t_near};
+        }
+    }
+    return hit;
+}
+
+#endif // !BVH_H
@@ -0,0 +1,195 @@
+// Renders a scene straight to an image file, no window or GL context needed. Meant for batch
+// jobs on machines without a GPU.
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "denoise.h"
+#include "kernels.h"
+#include "mesh.h"
+#include "raytracer.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+static void print_usage() {
+    std::printf(
+        "usage: raytracer-cli [options]\n"
+        "  --output FILE      .ppm, .png or .pfm (32 bit float), default render.png\n"
+        "  --width N          default %d\n"
+        "  --height N         default %d\n"
+        "  --spp N            samples per pixel, default 16\n"
+        "  --bounces N        default %d\n"
+        "  --threads N        default: every hardware thread\n"
+        "  --sampler NAME     random, sobol or bluenoise, default sobol\n"
+        "  --scatter N        scatter N small spheres on the ground, like the UI button\n"
+        "  --mesh FILE        add an OBJ model at (0, 0, -1), where the red sphere is\n"
+        "  --no-bvh           test every object for every ray\n"
+        "  --no-packets       trace camera rays one at a time\n"
+        "  --adaptive ERROR   stop sampling pixels whose relative error drops below ERROR (e.g. 0.02)\n"
+        "  --min-samples N    samples before a pixel may stop, default %d\n"
+        "  --denoise          run the a-trous denoiser over the result\n"
+        "  --denoise-passes N filter passes, 1 to %d, default %d\n"
+        "  --isa NAME         SIMD kernels to use, one of %s, default: the best this CPU runs\n",
+        width, height, max_bounces, adaptive_min_samples, denoise_max_iterations, denoise_iterations,
+        available_kernels());
+}
+
+static bool ends_with(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static bool write_image(const std::string& path, const std::vector<Color>& framebuffer) {
+    if (ends_with(path, ".pfm")) {
+        // PFM stores linear floats, bottom row first
+        std::vector<float> rgb((size_t)image_width * image_height * 3);
+        if (denoising) {
+            denoised_image(rgb.data());
+        } else {
+            accumulated_image(rgb.data());
+        }
+        FILE* file = std::fopen(path.c_str(), "wb");
+        if (!file) {
+            return false;
+        }
+        std::fprintf(file, "PF\n%d %d\n-1.0\n", image_width, image_height); // negative scale: little endian
+        for (int y = image_height - 1; y >= 0; y--) {
+            std::fwrite(&rgb[(size_t)y * image_width * 3], sizeof(float), (size_t)image_width * 3, file);
+        }
+        return std::fclose(file) == 0;
+    } else if (ends_with(path, ".ppm")) {
+        FILE* file = std::fopen(path.c_str(), "wb");
+        if (!file) {
+            return false;
+        }
+        std::fprintf(file, "P6\n%d %d\n255\n", image_width, image_height);
+        std::fwrite(framebuffer.data(), sizeof(Color), framebuffer.size(), file);
+        return std::fclose(file) == 0;
+    }
+    return stbi_write_png(path.c_str(), image_width, image_height, 3, framebuffer.data(),
+                          image_width * (int)sizeof(Color)) != 0;
+}
+
+int main(int argc, char** argv) {
+    std::string output = "render.png";
+    int spp = 16;
+    int scatter_count = 0;
+    std::vector<std::string> mesh_files;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(arg, "--output") == 0 && has_value) {
+            output = argv[++i];
+        } else if (std::strcmp(arg, "--width") == 0 && has_value) {
+            image_width = std::atoi(argv[++i]);
+        } else if (std::strcmp(arg, "--height") == 0 && has_value) {
+            image_height = std::atoi(argv[++i]);
+        } else if (std::strcmp(arg, "--spp") == 0 && has_value) {
+            spp = std::atoi(argv[++i]);
+        } else if (std::strcmp(arg, "--bounces") == 0 && has_value) {
+            max_bounces = std::atoi(argv[++i]);
+        } else if (std::strcmp(arg, "--threads") == 0 && has_value) {
+            thread_count = std::atoi(argv[++i]);
+        } else if (std::strcmp(arg, "--sampler") == 0 && has_value) {
+            std::string name = argv[++i];
+            if (name == "random") {
+                sampler_type = RandomSampler;
+            } else if (name == "sobol") {
+                sampler_type = SobolSampler;
+            } else if (name == "bluenoise") {
+                sampler_type = BlueNoiseSampler;
+            } else {
+                std::fprintf(stderr, "unknown sampler %s\n", name.c_str());
+                return 1;
+            }
+        } else if (std::strcmp(arg, "--scatter") == 0 && has_value) {
+            scatter_count = std::atoi(argv[++i]);
+        } else if (std::strcmp(arg, "--mesh") == 0 && has_value) {
+            mesh_files.push_back(argv[++i]);
+        } else if (std::strcmp(arg, "--no-bvh") == 0) {
+            use_bvh = false;
+        } else if (std::strcmp(arg, "--no-packets") == 0) {
+            packet_tracing = false;
+        } else if (std::strcmp(arg, "--adaptive") == 0 && has_value) {
+            adaptive_sampling = true;
+            adaptive_threshold = std::atof(argv[++i]);
+        } else if (std::strcmp(arg, "--min-samples") == 0 && has_value) {
+            adaptive_min_samples = std::atoi(argv[++i]);
+        } else if (std::strcmp(arg, "--denoise") == 0) {
+            denoising = true;
+        } else if (std::strcmp(arg, "--denoise-passes") == 0 && has_value) {
+            denoise_iterations = std::atoi(argv[++i]);
+        } else if (std::strcmp(arg, "--isa") == 0 && has_value) {
+            const char* isa = argv[++i];
+            if (!select_kernels(isa)) {
+                std::fprintf(stderr, "no %s kernels in this build or this CPU can't run them (built: %s)\n", isa,
+                             available_kernels());
+                return 1;
+            }
+        } else {
+            print_usage();
+            return std::strcmp(arg, "--help") == 0 ? 0 : 1;
+        }
+    }
+    if (image_width < 1 || image_height < 1 || spp < 1 || max_bounces < 1 || scatter_count < 0) {
+        std::fprintf(stderr, "width, height, spp and bounces have to be positive\n");
+        return 1;
+    }
+    if (denoise_iterations < 1 || denoise_iterations > denoise_max_iterations) {
+        std::fprintf(stderr, "--denoise-passes has to be 1 to %d\n", denoise_max_iterations);
+        return 1;
+    }
+
+    // same starting scene as the windowed raytracer
+    std::vector<Object> scene;
+    scene.push_back(create_sphere(Vec3(0, 0, -1), 0.5, Color(200, 10, 10)));
+    scene.push_back(create_sphere(Vec3(0, -100.5, -1), 100, Color(10, 10, 210)));
+    Rng scatter_rng = seed_rng(0, 0);
+    double extent = std::sqrt((double)scatter_count);
+    for (int i = 0; i < scatter_count; i++) {
+        double sphere_radius = 0.05 + 0.15 * random_double(scatter_rng);
+        Vec3 position(extent * (random_double(scatter_rng) * 2 - 1), -0.5 + sphere_radius,
+                      -1 - extent * random_double(scatter_rng));
+        Color color(random_double(scatter_rng) * 255, random_double(scatter_rng) * 255,
+                    random_double(scatter_rng) * 255);
+        scene.push_back(create_sphere(position, sphere_radius, color));
+    }
+    for (const std::string& mesh_file : mesh_files) {
+        int mesh_blas = add_mesh(load_mesh(mesh_file));
+        if (mesh_blas < 0) {
+            std::fprintf(stderr, "no valid faces in %s\n", mesh_file.c_str());
+            return 1;
+        }
+        scene.push_back(create_instance(TriangleMesh, mesh_blas, Vec3(0, 0, -1), 1, 0, Color(255, 255, 255)));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Color> framebuffer((size_t)image_width * image_height);
+    samples_per_pixel = spp;
+    accumulate = false;
+    render(framebuffer.data(), scene.data(), (int)scene.size());
+    double total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    if (!write_image(output, framebuffer)) {
+        std::fprintf(stderr, "failed to write %s\n", output.c_str());
+        return 1;
+    }
+    std::printf("%s: %dx%d, %d spp, %d objects, %d threads, %s kernels\n", output.c_str(), image_width,
+                image_height, spp, (int)scene.size(), thread_count, kernels.isa);
+    std::printf("scene build %.1f ms, render %.1f ms, total %.1f ms, %.2f Mrays/s\n", scene_bvh.build_ms,
+                render_stats.frame_ms, total_ms, render_stats.ray_count / (render_stats.frame_ms * 1000));
+    if (denoising) {
+        std::printf("denoised in %.1f ms, %d passes\n", render_stats.denoise_ms, denoise_iterations);
+    }
+    if (adaptive_sampling) {
+        long long uniform = render_stats.sample_count + render_stats.samples_saved;
+        std::printf("adaptive sampling: %lld of %lld samples, %.1f%% saved\n", render_stats.sample_count, uniform,
+                    100.0 * render_stats.samples_saved / uniform);
+    }
+    return 0;
+}
@@ -0,0 +1,52 @@
+#include "denoise.h"
+#include "kernels.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <utility>
+
+void DenoiseBuffers::resize(int new_width, int new_height) {
+    if (new_width == width && new_height == height) {
+        return;
+    }
+    width = new_width;
+    height = new_height;
+    // rows start on a 64 byte boundary, so the kernel can load centers aligned
+    stride = (2 * denoise_padding + width + max_simd_width + 15) / 16 * 16;
+    size_t size = (size_t)stride * (height + 2 * denoise_padding);
+    for (int channel = 0; channel < 3; channel++) {
+        color[channel].assign(size, 0.0f);
+        scratch[channel].assign(size, 0.0f);
+        normal[channel].assign(size, 0.0f);
+    }
+    depth.assign(size, 1.0f);
+    samples.assign(size, 0.0f);
+}
+
+void denoise(DenoiseBuffers& buffers, ThreadPool& pool, int iterations, float color_sigma, float depth_sigma) {
+    iterations = std::min(iterations, denoise_max_iterations);
+    int origin = buffers.index(0, 0);
+    AtrousPass pass;
+    pass.normal[0] = &buffers.normal[0][origin];
+    pass.normal[1] = &buffers.normal[1][origin];
+    pass.normal[2] = &buffers.normal[2][origin];
+    pass.depth = &buffers.depth[origin];
+    pass.samples = &buffers.samples[origin];
+    pass.width = buffers.width;
+    pass.stride = buffers.stride;
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        for (int channel = 0; channel < 3; channel++) {
+            pass.input[channel] = &buffers.color[channel][origin];
+            pass.output[channel] = &buffers.scratch[channel][origin];
+        }
+        pass.step = 1 << iteration;
+        pass.color_weight = (float)(1 << iteration) / (color_sigma * color_sigma);
+        pass.depth_weight = 1.0f / (depth_sigma * pass.step);
+        pool.parallel_for(buffers.height, [&](int y, int) {
+            kernels.atrous_row(pass, y);
+        });
+        for (int channel = 0; channel < 3; channel++) {
+            std::swap(buffers.color[channel], buffers.scratch[channel]);
+        }
+    }
+}
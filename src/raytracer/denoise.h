@@ -0,0 +1,42 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "simd.h"
+
+struct ThreadPool;
+
+// Edge-avoiding a-trous wavelet filter for low sample count frames, after Dammertz et al.
+// (HPG 2010). Each pass blurs with a 5x5 kernel whose taps are twice as far apart as the last
+// pass's, so 5 passes cover 125x125 pixels at 25 taps a pixel. Taps lose weight with distance in
+// color, normal and depth, which keeps object edges sharp.
+// Color goes in demodulated (divided by the first hit's albedo), so texture and object colors
+// aren't blurred together; the caller multiplies the albedo back in.
+constexpr int denoise_max_iterations = 5;
+// Margin around the planes, wide enough for the last pass's outermost taps
+constexpr int denoise_padding = 2 << (denoise_max_iterations - 1);
+
+// SoA planes of one frame, padded by denoise_padding (plus a vector on the right). Padding keeps
+// zero normals, so it never gets any weight.
+struct DenoiseBuffers {
+    int width = 0;
+    int height = 0;
+    int stride = 0; // floats per row
+    aligned_floats color[3];
+    aligned_floats scratch[3];
+    aligned_floats normal[3]; // unit length, or zero
+    aligned_floats depth;     // distance from the camera
+    aligned_floats samples;   // samples in each pixel's mean
+
+    // Clears the planes if the size changed
+    void resize(int new_width, int new_height);
+    int index(int x, int y) const { return (y + denoise_padding) * stride + denoise_padding + x; }
+};
+
+// Filters buffers.color in place with iterations passes (at most denoise_max_iterations).
+// color_sigma is the color difference at which a tap is down to e^-1 weight in the first pass for
+// a pixel of one sample. It shrinks with the square root of the center pixel's sample count, as
+// its noise does, and by sqrt(2) every pass. depth_sigma is the same for depth, relative to the center
+// pixel's depth and scaled by the tap distance.
+void denoise(DenoiseBuffers& buffers, ThreadPool& pool, int iterations, float color_sigma, float depth_sigma);
+
+#endif // !DENOISE_H
@@ -0,0 +1,46 @@
+#include "kernels.h"
+#include "bvh.h"
+#include "cpu_features.h"
+
+// One table per copy of kernels.cpp in the build, see CMakeLists.txt
+namespace kernels_baseline {
+extern const RayKernels ray_kernels;
+}
+#ifdef RAYTRACER_KERNELS_AVX2
+namespace kernels_avx2 {
+extern const RayKernels ray_kernels;
+}
+#endif
+#ifdef RAYTRACER_KERNELS_AVX512
+namespace kernels_avx512 {
+extern const RayKernels ray_kernels;
+}
+#endif
+
+// lowest level first
+static const KernelVariant<RayKernels> variants[] = {
+    {IsaBaseline, &kernels_baseline::ray_kernels},
+#ifdef RAYTRACER_KERNELS_AVX2
+    {IsaAVX2, &kernels_avx2::ray_kernels},
+#endif
+#ifdef RAYTRACER_KERNELS_AVX512
+    {IsaAVX512, &kernels_avx512::ray_kernels},
+#endif
+};
+
+// NOTE: "best" stops at the width of a BVH leaf. Rays mostly test one leaf's worth of primitives
+// at a time, and a 16 wide copy runs those half empty: AVX-512 measured slower than AVX2 on
+// every BVH case of renderer-bench and only wins on long flat runs (--no-bvh).
+static bool best_fits(const RayKernels& table) {
+    return table.simd_width <= bvh_max_leaf_size;
+}
+
+RayKernels kernels = startup_kernel_variant(variants, best_fits);
+
+bool select_kernels(const char* isa) {
+    return select_kernel_variant(variants, isa, best_fits, kernels);
+}
+
+const char* available_kernels() {
+    return kernel_variant_names(variants);
+}
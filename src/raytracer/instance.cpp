@@ -0,0 +1,119 @@
+#include "instance.h"
+#include "raytracer.h"
+
+
+std::vector<SphereSetBVH> sphere_set_bvhs;
+
+int add_sphere_set(const Object spheres[], int count) {
+    SphereSetBVH set;
+    std::vector<AABB> bounds(count);
+    for (int i = 0; i < count; i++) {
+        set.centers.push_back(spheres[i].center);
+        set.radii.push_back(spheres[i].radius);
+        bounds[i] = spheres[i].bounds();
+        set.bounds.grow(bounds[i]);
+    }
+    build_bvh(set.bvh, bounds.data(), count);
+    build_sphere_pool(set.pool, spheres, set.bvh.indices.data(), count);
+    sphere_set_bvhs.push_back(std::move(set));
+    return (int)sphere_set_bvhs.size() - 1;
+}
+
+static Vec3 rotate_y(const Vec3& vec, double cos_yaw, double sin_yaw) {
+    return Vec3(cos_yaw * vec.x + sin_yaw * vec.z, vec.y, cos_yaw * vec.z - sin_yaw * vec.x);
+}
+
+// Same float kernel and double check as hit_scene(), over one leaf of a sphere set
+static bool hit_set_slots(const SphereSetBVH& set, int first, int count, const Ray& ray, const PoolRay& pool_ray,
+                          double tmin, double& closest, HitRecord& hit_record) {
+    float t;
+    int slot = hit_spheres(set.pool, first, count, pool_ray, (float)tmin, (float)closest, t);
+    if (slot < 0) {
+        return false;
+    }
+    int sphere = set.pool.objects[slot];
+    if (!hit_sphere(set.centers[sphere], set.radii[sphere], ray, tmin, closest, hit_record)) {
+        // float and double disagree about a grazing hit, let the double test settle the whole run
+        slot = -1;
+        for (int i = first; i < first + count; i++) {
+            sphere = set.pool.objects[i];
+            if (hit_sphere(set.centers[sphere], set.radii[sphere], ray, tmin, closest, hit_record)) {
+                closest = hit_record.t;
+                slot = i;
+            }
+        }
+        if (slot < 0) {
+            return false;
+        }
+    }
+    closest = hit_record.t;
+    hit_record.color = Vec3(set.pool.color_r[slot], set.pool.color_g[slot], set.pool.color_b[slot]);
+    return true;
+}
+
+bool hit_instance(const Object& instance, const Ray& ray, double tmin, double tmax, HitRecord& hit_record) {
+    // world to instance space is the inverse rotation, so -yaw
+    double cos_yaw = instance.cos_yaw;
+    double sin_yaw = instance.sin_yaw;
+    Ray local(rotate_y(ray.origin - instance.center, cos_yaw, -sin_yaw) / instance.radius,
+              rotate_y(ray.direction, cos_yaw, -sin_yaw) / instance.radius);
+    double closest = tmax;
+    Vec3 normal;
+    switch (instance.object_type) {
+        case TriangleMesh: {
+            if (!hit_mesh(mesh_bvhs[instance.blas], local, tmin, closest, normal)) {
+                return false;
+            }
+            hit_record.color = Vec3(1, 1, 1);
+            break;
+        } case SphereSet: {
+            const SphereSetBVH& set = sphere_set_bvhs[instance.blas];
+            PoolRay pool_ray = make_pool_ray(local);
+            bool hit = traverse_bvh(set.bvh, local.origin, local.direction, tmin, closest, [&](int first, int count) {
+                return hit_set_slots(set, first, count, local, pool_ray, tmin, closest, hit_record);
+            });
+            if (!hit) {
+                return false;
+            }
+            normal = hit_record.normal;
+            break;
+        } default: {
+            return false;
+        }
+    }
+    // uniform scale, so normals only need the rotation
+    hit_record.t = closest;
+    hit_record.point = ray.at(closest);
+    hit_record.normal = normalize(rotate_y(normal, cos_yaw, sin_yaw));
+    hit_record.front_face = dot(ray.direction, hit_record.normal) < 0;
+    hit_record.normal = hit_record.front_face ? hit_record.normal : -1 * hit_record.normal;
+    return true;
+}
+
+AABB instance_bounds(const Object& instance) {
+    AABB local;
+    switch (instance.object_type) {
+        case TriangleMesh: {
+            local = mesh_bvhs[instance.blas].bounds;
+            break;
+        } case SphereSet: {
+            local = sphere_set_bvhs[instance.blas].bounds;
+            break;
+        } default: {
+            return AABB();
+        }
+    }
+    if (local.min.x > local.max.x) {
+        return AABB();
+    }
+    // box around the turned corners of the local box
+    double cos_yaw = instance.cos_yaw;
+    double sin_yaw = instance.sin_yaw;
+    AABB bounds;
+    for (int corner = 0; corner < 8; corner++) {
+        Vec3 point(corner & 1 ? local.max.x : local.min.x, corner & 2 ? local.max.y : local.min.y,
+                   corner & 4 ? local.max.z : local.min.z);
+        bounds.grow(instance.center + instance.radius * rotate_y(point, cos_yaw, sin_yaw));
+    }
+    return bounds;
+}
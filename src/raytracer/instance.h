@@ -0,0 +1,38 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <vector>
+
+#include "bvh.h"
+#include "sphere_pool.h"
+
+struct Object;
+struct Ray;
+struct HitRecord;
+
+// Two level scene: scene_bvh is the top level over every Object, and the instance objects
+// (TriangleMesh, SphereSet) point at a bottom level structure built once per asset. Copies of an
+// asset only cost their Object, and moving one only rebuilds the top level.
+
+// A group of spheres with its own BVH, instanced like a mesh. Sphere colors are multiplied by
+// the instance color.
+struct SphereSetBVH {
+    std::vector<Vec3> centers; // in the order they were added, pool.objects indexes these
+    std::vector<double> radii;
+    BVH bvh;
+    SpherePool pool;
+    AABB bounds;
+};
+
+extern std::vector<SphereSetBVH> sphere_set_bvhs;
+
+// Builds the BVH over spheres (which all have to be spheres) and returns the set's index in
+// sphere_set_bvhs
+int add_sphere_set(const Object spheres[], int count);
+
+// Instances are scaled by their radius, turned by yaw (radians) around +y and moved to their
+// center. The ray is taken into instance space instead, which keeps t the same in both.
+bool hit_instance(const Object& instance, const Ray& ray, double tmin, double tmax, HitRecord& hit_record);
+AABB instance_bounds(const Object& instance);
+
+#endif // !INSTANCE_H
@@ -0,0 +1,282 @@
+// Compiled once per instruction set, with KERNEL_NAMESPACE and the compiler flags set by
+// CMakeLists.txt. Keep this file to simd.h and the plain structs of kernels.h, see there.
+#include "simd.h"
+#include "kernels.h"
+
+#ifndef KERNEL_NAMESPACE
+#define KERNEL_NAMESPACE kernels_baseline
+#endif
+
+static_assert(simd_width <= max_simd_width, "arrays are only padded by max_simd_width");
+static_assert(packet_rays % simd_width == 0, "packets have to fill whole vectors");
+
+namespace KERNEL_NAMESPACE {
+
+// Nearest of the lanes that hit something, or -1
+static int nearest_lane(vfloat best_t, vfloat best_slot, float& t) {
+    int hit_lanes = bits(best_slot >= vfloat(0.0f));
+    if (hit_lanes == 0) {
+        return -1;
+    }
+    alignas(64) float lane_t[simd_width];
+    alignas(64) float lane_slot[simd_width];
+    best_t.store(lane_t);
+    best_slot.store(lane_slot);
+    int hit = -1;
+    for (int lane = 0; lane < simd_width; lane++) {
+        if ((hit_lanes & (1 << lane)) && lane_t[lane] < t) {
+            t = lane_t[lane];
+            hit = (int)lane_slot[lane];
+        }
+    }
+    return hit;
+}
+
+static int hit_spheres(const SphereArrays& spheres, int first, int count, const PoolRay& ray, float tmin,
+                       float tmax, float& t) {
+    // work in distances along the unit direction
+    vfloat vtmin = tmin * ray.length;
+    vfloat origin_x = ray.origin_x;
+    vfloat origin_y = ray.origin_y;
+    vfloat origin_z = ray.origin_z;
+    vfloat direction_x = ray.direction_x;
+    vfloat direction_y = ray.direction_y;
+    vfloat direction_z = ray.direction_z;
+
+    // NOTE: hit_sphere()'s h * h - a * c cancels catastrophically in float for small spheres far
+    // away, so the discriminant is taken from the distance between the center and the ray
+    // instead (Ray Tracing Gems, chapter 7): radius^2 - |to_sphere - h * direction|^2.
+    vfloat best_t = tmax * ray.length;
+    vfloat best_slot = -1.0f;
+    vfloat lanes = vfloat::lane_index();
+    int end = first + count;
+    for (int i = first; i < end; i += simd_width) {
+        vfloat to_x = vfloat::loadu(spheres.center_x + i) - origin_x;
+        vfloat to_y = vfloat::loadu(spheres.center_y + i) - origin_y;
+        vfloat to_z = vfloat::loadu(spheres.center_z + i) - origin_z;
+        vfloat h = direction_x * to_x + direction_y * to_y + direction_z * to_z;
+        vfloat offset_x = to_x - h * direction_x;
+        vfloat offset_y = to_y - h * direction_y;
+        vfloat offset_z = to_z - h * direction_z;
+        vfloat discriminant = vfloat::loadu(spheres.radius2 + i) -
+            (offset_x * offset_x + offset_y * offset_y + offset_z * offset_z);
+
+        vfloat slot = lanes + vfloat((float)i);
+        vmask valid = (discriminant >= vfloat(0.0f)) & (slot < vfloat((float)end));
+        if (bits(valid) == 0) {
+            continue;
+        }
+        vfloat sqrt_discriminant = vsqrt(vmax(discriminant, vfloat(0.0f)));
+        vfloat near_root = h - sqrt_discriminant;
+        vfloat far_root = h + sqrt_discriminant;
+        vfloat root = select(near_root > vtmin, near_root, far_root);
+        vmask closer = valid & (root > vtmin) & (root < best_t);
+        best_t = select(closer, root, best_t);
+        best_slot = select(closer, slot, best_slot);
+    }
+
+    float nearest = tmax * ray.length;
+    int hit = nearest_lane(best_t, best_slot, nearest);
+    t = nearest / ray.length;
+    return hit;
+}
+
+static int hit_triangles(const TriangleArrays& triangles, int first, int count, const TriangleRay& ray,
+                         float tmin, float tmax, float& t) {
+    const int kx = ray.kx;
+    const int ky = ray.ky;
+    const int kz = ray.kz;
+    const float* const* corners = &triangles.corners[0][0];
+    vfloat origin_x = ray.origin[kx];
+    vfloat origin_y = ray.origin[ky];
+    vfloat origin_z = ray.origin[kz];
+    vfloat shear_x = ray.shear_x;
+    vfloat shear_y = ray.shear_y;
+    vfloat shear_z = ray.shear_z;
+    vfloat vtmin = tmin;
+    vfloat best_t = tmax;
+    vfloat best_slot = -1.0f;
+    vfloat lanes = vfloat::lane_index();
+    int end = first + count;
+    for (int i = first; i < end; i += simd_width) {
+        // corners relative to the origin, sheared so the ray runs along z
+        vfloat a_z = vfloat::loadu(corners[0 * 3 + kz] + i) - origin_z;
+        vfloat b_z = vfloat::loadu(corners[1 * 3 + kz] + i) - origin_z;
+        vfloat c_z = vfloat::loadu(corners[2 * 3 + kz] + i) - origin_z;
+        vfloat a_x = vfloat::loadu(corners[0 * 3 + kx] + i) - origin_x - shear_x * a_z;
+        vfloat a_y = vfloat::loadu(corners[0 * 3 + ky] + i) - origin_y - shear_y * a_z;
+        vfloat b_x = vfloat::loadu(corners[1 * 3 + kx] + i) - origin_x - shear_x * b_z;
+        vfloat b_y = vfloat::loadu(corners[1 * 3 + ky] + i) - origin_y - shear_y * b_z;
+        vfloat c_x = vfloat::loadu(corners[2 * 3 + kx] + i) - origin_x - shear_x * c_z;
+        vfloat c_y = vfloat::loadu(corners[2 * 3 + ky] + i) - origin_y - shear_y * c_z;
+
+        // scaled barycentrics, all of one sign when the ray passes inside (edges count as inside)
+        vfloat u = c_x * b_y - c_y * b_x;
+        vfloat v = a_x * c_y - a_y * c_x;
+        vfloat w = b_x * a_y - b_y * a_x;
+        vfloat zero = 0.0f;
+        vmask inside = ((u >= zero) & (v >= zero) & (w >= zero)) | ((u <= zero) & (v <= zero) & (w <= zero));
+        vfloat det = u + v + w;
+        vfloat slot = lanes + vfloat((float)i);
+        vmask valid = inside & ((det < zero) | (det > zero)) & (slot < vfloat((float)end));
+        if (bits(valid) == 0) {
+            continue;
+        }
+        vfloat scaled_t = u * (shear_z * a_z) + v * (shear_z * b_z) + w * (shear_z * c_z);
+        // det is only zero in lanes that already failed
+        vfloat lane_t = scaled_t / select(valid, det, vfloat(1.0f));
+        vmask closer = valid & (lane_t > vtmin) & (lane_t < best_t);
+        best_t = select(closer, lane_t, best_t);
+        best_slot = select(closer, slot, best_slot);
+    }
+
+    t = tmax;
+    return nearest_lane(best_t, best_slot, t);
+}
+
+// Same math as hit_spheres(), one sphere at a time against simd_width rays
+static void hit_packet_spheres(PacketLanes& packet, const SphereArrays& spheres, int first, int count,
+                               const float origin[3], float tmin) {
+    vfloat vtmin = tmin;
+    for (int slot = first; slot < first + count; slot++) {
+        if (spheres.radius2[slot] < 0) {
+            continue;
+        }
+        vfloat to_x = spheres.center_x[slot] - origin[0];
+        vfloat to_y = spheres.center_y[slot] - origin[1];
+        vfloat to_z = spheres.center_z[slot] - origin[2];
+        vfloat radius2 = spheres.radius2[slot];
+        vfloat vslot = (float)slot;
+        for (int i = 0; i < packet_rays; i += simd_width) {
+            vfloat direction_x = vfloat::load(&packet.direction_x[i]);
+            vfloat direction_y = vfloat::load(&packet.direction_y[i]);
+            vfloat direction_z = vfloat::load(&packet.direction_z[i]);
+            vfloat h = direction_x * to_x + direction_y * to_y + direction_z * to_z;
+            vfloat offset_x = to_x - h * direction_x;
+            vfloat offset_y = to_y - h * direction_y;
+            vfloat offset_z = to_z - h * direction_z;
+            vfloat discriminant = radius2 - (offset_x * offset_x + offset_y * offset_y + offset_z * offset_z);
+            vmask valid = discriminant >= vfloat(0.0f);
+            if (bits(valid) == 0) {
+                continue;
+            }
+            vfloat sqrt_discriminant = vsqrt(vmax(discriminant, vfloat(0.0f)));
+            vfloat near_root = h - sqrt_discriminant;
+            vfloat far_root = h + sqrt_discriminant;
+            vfloat root = select(near_root > vtmin, near_root, far_root);
+            vfloat t = vfloat::load(&packet.t[i]);
+            vmask closer = valid & (root > vtmin) & (root < t);
+            select(closer, root, t).store(&packet.t[i]);
+            select(closer, vslot, vfloat::load(&packet.slot[i])).store(&packet.slot[i]);
+        }
+    }
+}
+
+static bool packet_hits_box(const PacketLanes& packet, const float box[6], float tmin) {
+    vfloat vtmin = tmin;
+    vfloat min_x = box[0];
+    vfloat min_y = box[1];
+    vfloat min_z = box[2];
+    vfloat max_x = box[3];
+    vfloat max_y = box[4];
+    vfloat max_z = box[5];
+    for (int i = 0; i < packet_rays; i += simd_width) {
+        vfloat inverse_x = vfloat::load(&packet.inverse_x[i]);
+        vfloat inverse_y = vfloat::load(&packet.inverse_y[i]);
+        vfloat inverse_z = vfloat::load(&packet.inverse_z[i]);
+        vfloat tx1 = min_x * inverse_x;
+        vfloat tx2 = max_x * inverse_x;
+        vfloat ty1 = min_y * inverse_y;
+        vfloat ty2 = max_y * inverse_y;
+        vfloat tz1 = min_z * inverse_z;
+        vfloat tz2 = max_z * inverse_z;
+        vfloat enter = vmax(vmax(vtmin, vmin(tx1, tx2)), vmax(vmin(ty1, ty2), vmin(tz1, tz2)));
+        vfloat exit = vmin(vmin(vfloat::load(&packet.t[i]), vmax(tx1, tx2)), vmin(vmax(ty1, ty2), vmax(tz1, tz2)));
+        if (bits(enter <= exit) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void resolve_pixels(const float* sums, unsigned char* bytes, int count, float samples) {
+    vfloat divisor = samples;
+    int i = 0;
+    for (; i + simd_width <= count; i += simd_width) {
+        store_bytes(vfloat::loadu(sums + i) / divisor, bytes + i);
+    }
+    for (; i < count; i++) {
+        float value = sums[i] / samples;
+        bytes[i] = value >= 255.0f ? 255 : value > 0.0f ? (unsigned char)value : 0;
+    }
+}
+
+// Dammertz et al., "Edge-Avoiding A-Trous Wavelet Transform for fast Global Illumination
+// Filtering" (HPG 2010): a 5x5 B3 spline whose taps spread out by step, each weighted down by
+// how far its color, normal and depth are from the center's
+static void atrous_row(const AtrousPass& pass, int y) {
+    static const float spline[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16};
+    vfloat zero = 0.0f;
+    for (int x = 0; x < pass.width; x += simd_width) {
+        int center = y * pass.stride + x;
+        vfloat center_r = vfloat::load(pass.input[0] + center);
+        vfloat center_g = vfloat::load(pass.input[1] + center);
+        vfloat center_b = vfloat::load(pass.input[2] + center);
+        vfloat normal_x = vfloat::load(pass.normal[0] + center);
+        vfloat normal_y = vfloat::load(pass.normal[1] + center);
+        vfloat normal_z = vfloat::load(pass.normal[2] + center);
+        vfloat depth = vfloat::load(pass.depth + center);
+        vfloat depth_weight = vfloat(pass.depth_weight) / vmax(depth, vfloat(1e-6f));
+        // the mean's variance falls with its sample count, so sigma^2 does too
+        vfloat color_weight = vfloat(pass.color_weight) * vfloat::load(pass.samples + center);
+
+        vfloat sum_r = zero;
+        vfloat sum_g = zero;
+        vfloat sum_b = zero;
+        vfloat total = zero;
+        for (int j = 0; j < 5; j++) {
+            for (int i = 0; i < 5; i++) {
+                int tap = center + ((j - 2) * pass.stride + i - 2) * pass.step;
+                vfloat r = vfloat::loadu(pass.input[0] + tap);
+                vfloat g = vfloat::loadu(pass.input[1] + tap);
+                vfloat b = vfloat::loadu(pass.input[2] + tap);
+                vfloat dr = r - center_r;
+                vfloat dg = g - center_g;
+                vfloat db = b - center_b;
+                vfloat tap_depth = vfloat::loadu(pass.depth + tap);
+                vfloat depth_distance = vmax(tap_depth - depth, depth - tap_depth);
+                vfloat exponent = (dr * dr + dg * dg + db * db) * color_weight + depth_distance * depth_weight;
+
+                // cos^64 of the angle between the (unit) normals, zero for the padding
+                vfloat cosine = vmax(zero, normal_x * vfloat::loadu(pass.normal[0] + tap) +
+                                               normal_y * vfloat::loadu(pass.normal[1] + tap) +
+                                               normal_z * vfloat::loadu(pass.normal[2] + tap));
+                for (int k = 0; k < 6; k++) {
+                    cosine = cosine * cosine;
+                }
+                vfloat weight = vfloat(spline[j] * spline[i]) * cosine * vexp_negative(zero - exponent);
+                sum_r = sum_r + weight * r;
+                sum_g = sum_g + weight * g;
+                sum_b = sum_b + weight * b;
+                total = total + weight;
+            }
+        }
+        vfloat inverse = vfloat(1.0f) / vmax(total, vfloat(1e-30f));
+        (sum_r * inverse).store(pass.output[0] + center);
+        (sum_g * inverse).store(pass.output[1] + center);
+        (sum_b * inverse).store(pass.output[2] + center);
+    }
+}
+
+extern const RayKernels ray_kernels = {
+    SIMD_ISA_NAME,
+    simd_width,
+    hit_spheres,
+    hit_triangles,
+    hit_packet_spheres,
+    packet_hits_box,
+    resolve_pixels,
+    atrous_row,
+};
+
+} // namespace KERNEL_NAMESPACE
@@ -0,0 +1,103 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+// The raytracer's SIMD kernels. kernels.cpp is compiled once per instruction set the build
+// targets (see CMakeLists.txt), each copy in its own namespace with its own RayKernels table,
+// and `kernels` points at the best copy this CPU runs, chosen once at startup by
+// startup_kernel_variant() in cpu_features.h (see best_fits() in dispatch.cpp for what best means).
+// NOTE: kernels.cpp only sees the plain structs below. If it used a std template or an inline
+// function from render.h, the linker could keep its AVX2 copy for every caller in the program.
+
+constexpr int packet_size = 4; // a packet covers packet_size x packet_size pixels
+constexpr int packet_rays = packet_size * packet_size;
+
+// A ray set up for hit_spheres(). The direction is normalized, see hit_spheres().
+struct PoolRay {
+    float origin_x, origin_y, origin_z;
+    float direction_x, direction_y, direction_z;
+    float length; // of the original direction, to convert between distance and ray t
+};
+
+// Ray set up for the watertight test of Woop et al., "Watertight Ray/Triangle Intersection"
+// (JCGT 2013): triangles are moved into a space where the ray starts at the origin and runs
+// along +z, so the edge tests are 2D and neighbouring triangles agree exactly on shared edges.
+struct TriangleRay {
+    int kx, ky, kz; // axes permuted so kz is the largest direction component
+    float origin[3];
+    float shear_x, shear_y, shear_z;
+};
+
+// SoA arrays of a SpherePool, padded by max_simd_width
+struct SphereArrays {
+    const float* center_x;
+    const float* center_y;
+    const float* center_z;
+    const float* radius2; // negative for slots that are not spheres
+};
+
+// SoA corners of a MeshBVH, padded by max_simd_width
+struct TriangleArrays {
+    const float* corners[3][3]; // corners[corner][axis][triangle]
+};
+
+// The per ray lanes of a RayPacket. Directions are normalized, so t is a distance.
+struct PacketLanes {
+    alignas(64) float direction_x[packet_rays];
+    alignas(64) float direction_y[packet_rays];
+    alignas(64) float direction_z[packet_rays];
+    alignas(64) float inverse_x[packet_rays];
+    alignas(64) float inverse_y[packet_rays];
+    alignas(64) float inverse_z[packet_rays];
+    alignas(64) float t[packet_rays]; // nearest hit so far
+    alignas(64) float slot[packet_rays]; // sphere pool slot of that hit, -1 for none
+};
+
+// One pass of the edge-avoiding a-trous filter over a row, see denoise.h. Planes are padded so
+// every tap of every pass reads inside them, with zero normals there so padding gets no weight.
+struct AtrousPass {
+    const float* input[3]; // demodulated color, pointing at pixel (0, 0), stride floats per row
+    float* output[3];
+    const float* normal[3];
+    const float* depth;
+    const float* samples; // per pixel, scales color_weight
+    int width;
+    int stride;
+    int step;           // pixels between taps, doubling every pass
+    float color_weight; // 1 / sigma^2 of the color distance for one sample, for this pass
+    float depth_weight; // 1 / sigma of the depth distance relative to the center's depth
+};
+
+struct RayKernels {
+    const char* isa; // instruction set this copy was compiled for
+    int simd_width;
+    // Nearest sphere in slots [first, first + count) hit within (tmin, tmax), or -1. t is set to
+    // the hit's ray parameter.
+    int (*hit_spheres)(const SphereArrays& spheres, int first, int count, const PoolRay& ray, float tmin,
+                       float tmax, float& t);
+    // Nearest triangle in slots [first, first + count) hit within (tmin, tmax), or -1
+    int (*hit_triangles)(const TriangleArrays& triangles, int first, int count, const TriangleRay& ray,
+                         float tmin, float tmax, float& t);
+    // Every sphere in slots [first, first + count) against every ray of the packet. origin is the
+    // packet's, tmin a distance. Slots that are not spheres are skipped.
+    void (*hit_packet_spheres)(PacketLanes& packet, const SphereArrays& spheres, int first, int count,
+                               const float origin[3], float tmin);
+    // True when any ray enters the box before its current nearest hit. box is min x, y, z then
+    // max x, y, z, relative to the packet's origin.
+    bool (*packet_hits_box)(const PacketLanes& packet, const float box[6], float tmin);
+    // bytes[i] = sums[i] / samples, truncated and clamped to 0..255
+    void (*resolve_pixels)(const float* sums, unsigned char* bytes, int count, float samples);
+    // Filters row y of pass.input into pass.output. Writes whole vectors, up to simd_width - 1
+    // pixels into the right padding.
+    void (*atrous_row)(const AtrousPass& pass, int y);
+};
+
+extern RayKernels kernels;
+
+// Switches to the copy compiled for isa ("sse2", "avx2", "avx512", or "best"). Returns false and
+// keeps the current one if this build has no such copy or the CPU can't run it.
+// The RENDER_ISA environment variable does the same at startup.
+bool select_kernels(const char* isa);
+// Instruction sets of the copies in this build, comma separated
+const char* available_kernels();
+
+#endif // !KERNELS_H
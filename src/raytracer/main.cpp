@@ -7,9 +7,12 @@
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <cmath>
 
 #include "render.h"
 #include "raytracer.h"
+#include "denoise.h"
+#include "kernels.h"
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
@@ -88,9 +91,52 @@ static std::string read_file(const std::string& filepath) {
     return file;
 }
 
+// The texture takes the size of the last frame, the screen quad stretches it over the viewport so
+// frames below window size get scaled up by the texture's linear filter
 static inline void update_framebuffer(const Color framebuffer[]) {
     // TODO(Ben): possibly switch to two textures and see if performance is better
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, framebuffer);
+    static int texture_width = width;
+    static int texture_height = height;
+    if (image_width != texture_width || image_height != texture_height) {
+        texture_width = image_width;
+        texture_height = image_height;
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image_width, image_height, 0, GL_RGB, GL_UNSIGNED_BYTE, framebuffer);
+        return;
+    }
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image_width, image_height, GL_RGB, GL_UNSIGNED_BYTE, framebuffer);
+}
+
+// Dynamic resolution: while the camera moves, frames render at a fraction of the window size
+// picked to keep render() near target_frame_ms, and go back to full size once it stops.
+static bool dynamic_resolution = false;
+static float target_frame_ms = 33.0f;
+constexpr double min_resolution_scale = 0.25;
+constexpr double still_seconds = 0.1; // mouse look doesn't move the camera every frame
+static Vec3 last_camera;
+static Vec3 last_camera_direction;
+static double last_move_time = -1e9;
+
+// Sets image_width and image_height for the next frame
+static void choose_resolution() {
+    double now = glfwGetTime();
+    if (!(camera == last_camera) || !(camera_direction == last_camera_direction)) {
+        last_camera = camera;
+        last_camera_direction = camera_direction;
+        last_move_time = now;
+    }
+    if (!dynamic_resolution || now - last_move_time >= still_seconds) {
+        image_width = width;
+        image_height = height;
+        return;
+    }
+    // frame time goes about with the pixel count, so the side scales with its square root
+    double scale = (double)image_width / width;
+    if (render_stats.frame_ms > 0) {
+        scale *= std::sqrt(target_frame_ms / render_stats.frame_ms);
+    }
+    scale = std::max(min_resolution_scale, std::min(scale, 1.0));
+    image_width = std::max(1, (int)(width * scale + 0.5));
+    image_height = std::max(1, (int)(height * scale + 0.5));
 }
 
 int main() {
@@ -198,11 +244,13 @@ int main() {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // rows of a scaled down frame are 3 * image_width bytes, not always a multiple of 4
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
     glClearColor(0, 0, 0, 0);
-    const int max_objects = 100;
+    const int max_objects = 1 << 20;
     int selected_sphere_index = -1; //if nothing is selected
-    Object scene[max_objects];
+    Object* scene = new Object[max_objects];
     int object_count = 2;
     scene[0] = create_sphere(Vec3(0, 0, -1), 0.5, Color(200, 10, 10));
     scene[1] = create_sphere(Vec3(0, -100.5, -1), 100, Color(10, 10, 210));
@@ -219,6 +267,10 @@ int main() {
     float position[3] = {1.0f, 0.0f, -1.0f};
     float radius = 0.5f;
     float color[3] = {1.0f, 1.0f, 1.0f}; 
+    int scatter_count = 10000;
+    Rng scatter_rng = seed_rng(0, 0);
+    char model_file[256] = "";
+    int instance_count = 1000;
     //
 
     while (!glfwWindowShouldClose(window)) {
@@ -252,6 +304,12 @@ int main() {
         {
             ImGui::Begin("Scene Controls");
             ImGui::Checkbox("Pause Rendering", &render_pause);
+            ImGui::Checkbox("Accumulate Samples", &accumulate);
+            ImGui::SameLine();
+            if (ImGui::Button("Reset")) {
+                reset_accumulation();
+            }
+            ImGui::Text("Accumulated samples: %d", accumulated_samples);
             ImGui::InputFloat3("Position", position);
             ImGui::SliderFloat("Radius", &radius, 0.1f, 10.0f);
             ImGui::ColorEdit3("Color", color);
@@ -270,16 +328,89 @@ int main() {
                     ImGui::Text("Maximum objs");
                 }
             }
-            ImGui::Text("Number of spheres: %d", object_count);
+            // Load an OBJ file, Position and Radius place and scale it
+            ImGui::InputText("Model File", model_file, sizeof(model_file));
+            if (ImGui::Button("Add Model") && object_count < max_objects) {
+                int mesh_blas = add_mesh(load_mesh(model_file));
+                if (mesh_blas >= 0) {
+                    Vec3 pos = Vec3(position[0], position[1], position[2]);
+                    Color col = Color(
+                        static_cast<unsigned char>(color[0] * 255),
+                        static_cast<unsigned char>(color[1] * 255),
+                        static_cast<unsigned char>(color[2] * 255)
+                    );
+                    scene[object_count++] = create_instance(TriangleMesh, mesh_blas, pos, radius, 0, col);
+                }
+            }
+            // A clump of small spheres as one instanceable asset
+            if (ImGui::Button("Add Sphere Cluster") && object_count < max_objects) {
+                Object cluster[64];
+                for (int i = 0; i < 64; i++) {
+                    Vec3 offset(random_double(scatter_rng) * 2 - 1, random_double(scatter_rng) * 2 - 1,
+                                random_double(scatter_rng) * 2 - 1);
+                    Color col(random_double(scatter_rng) * 255, random_double(scatter_rng) * 255,
+                              random_double(scatter_rng) * 255);
+                    cluster[i] = create_sphere((0.8 / std::sqrt(3.0)) * offset, 0.2, col);
+                }
+                Vec3 pos = Vec3(position[0], position[1], position[2]);
+                scene[object_count++] = create_instance(SphereSet, add_sphere_set(cluster, 64), pos, radius, 0,
+                                                        Color(255, 255, 255));
+            }
+            // Scatter lots of small spheres on the ground, for stress testing
+            ImGui::InputInt("Scatter Count", &scatter_count, 1000, 10000);
+            scatter_count = std::max(0, std::min(scatter_count, max_objects - object_count));
+            if (ImGui::Button("Scatter Spheres")) {
+                double extent = std::sqrt((double)scatter_count);
+                for (int i = 0; i < scatter_count; i++) {
+                    double sphere_radius = 0.05 + 0.15 * random_double(scatter_rng);
+                    Vec3 pos(extent * (random_double(scatter_rng) * 2 - 1), -0.5 + sphere_radius,
+                             -1 - extent * random_double(scatter_rng));
+                    Color col(random_double(scatter_rng) * 255, random_double(scatter_rng) * 255,
+                              random_double(scatter_rng) * 255);
+                    scene[object_count++] = create_sphere(pos, sphere_radius, col);
+                }
+            }
+            // Copies of the selected model or cluster, they share its BVH
+            ImGui::InputInt("Instance Count", &instance_count, 100, 1000);
+            instance_count = std::max(0, std::min(instance_count, max_objects - object_count));
+            if (ImGui::Button("Scatter Instances") && selected_sphere_index >= 0 &&
+                selected_sphere_index < object_count && scene[selected_sphere_index].object_type != Sphere) {
+                Object original = scene[selected_sphere_index];
+                double extent = 4 * original.radius * std::sqrt((double)instance_count);
+                for (int i = 0; i < instance_count; i++) {
+                    Object copy = original;
+                    copy.center = original.center + Vec3(extent * (random_double(scatter_rng) * 2 - 1), 0,
+                                                         -extent * random_double(scatter_rng));
+                    double yaw = random_double(scatter_rng) * 2 * 3.14159265358979;
+                    copy.cos_yaw = std::cos(yaw);
+                    copy.sin_yaw = std::sin(yaw);
+                    scene[object_count++] = copy;
+                }
+            }
+            ImGui::Text("Number of objects: %d", object_count);
+            ImGui::Checkbox("Use BVH", &use_bvh);
+            ImGui::Checkbox("Packet Tracing", &packet_tracing);
+            ImGui::Text("BVH: %d nodes, built in %.2f ms", (int)scene_bvh.nodes.size(), scene_bvh.build_ms);
+            // Dragging an object refits the BVH, it gets rebuilt in the background once it degrades
+            ImGui::Text("BVH quality: %.2f, last refit %.3f ms%s", bvh_quality(scene_bvh), render_stats.refit_ms,
+                        render_stats.bvh_rebuilding ? ", rebuilding" : "");
+            ImGui::Text("Instanced assets: %d meshes, %d sphere clusters", (int)mesh_bvhs.size(),
+                        (int)sphere_set_bvhs.size());
             ImGui::Separator();
             ImGui::Text("Spheres in Scene:");
 
-            //list of spheres
-            for (int i = 0; i < object_count; ++i) {
-                char label[32];
-                snprintf(label, sizeof(label), "Sphere %d", i);
-                if (ImGui::Selectable(label, selected_sphere_index == i)) {
-                    selected_sphere_index = i; // Update selected sphere index
+            //list of spheres, only the visible rows are submitted
+            ImGuiListClipper clipper;
+            clipper.Begin(object_count);
+            while (clipper.Step()) {
+                for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+                    char label[32];
+                    const char* kind = scene[i].object_type == TriangleMesh ? "Mesh" :
+                                       scene[i].object_type == SphereSet ? "Cluster" : "Sphere";
+                    snprintf(label, sizeof(label), "%s %d", kind, i);
+                    if (ImGui::Selectable(label, selected_sphere_index == i)) {
+                        selected_sphere_index = i; // Update selected sphere index
+                    }
                 }
             }
 
@@ -309,6 +440,15 @@ int main() {
                     selected_sphere.radius = edit_radius;
                 }
 
+                // Edit Yaw, only instances can turn
+                if (selected_sphere.object_type != Sphere) {
+                    float edit_yaw = std::atan2(selected_sphere.sin_yaw, selected_sphere.cos_yaw);
+                    if (ImGui::SliderAngle("Edit Yaw", &edit_yaw, -180.0f, 180.0f)) {
+                        selected_sphere.cos_yaw = std::cos(edit_yaw);
+                        selected_sphere.sin_yaw = std::sin(edit_yaw);
+                    }
+                }
+
                 // Edit Color
                 float edit_color[3] = {
                     static_cast<float>(selected_sphere.color.x),
@@ -339,12 +479,67 @@ int main() {
                 samples_per_pixel = 1;
             }  
 
+            //Adaptive sampling
+            ImGui::Checkbox("Adaptive Sampling", &adaptive_sampling);
+            if (adaptive_sampling) {
+                float threshold = (float)adaptive_threshold;
+                if (ImGui::SliderFloat("Error Threshold", &threshold, 0.001f, 0.2f, "%.3f")) {
+                    adaptive_threshold = threshold;
+                }
+                ImGui::InputInt("Min Samples", &adaptive_min_samples);
+                if (adaptive_min_samples < 2) {
+                    adaptive_min_samples = 2;
+                }
+                long long uniform = render_stats.sample_count + render_stats.samples_saved;
+                ImGui::Text("Samples: %lld, %.1f%% saved", render_stats.sample_count,
+                            uniform > 0 ? 100.0 * render_stats.samples_saved / uniform : 0.0);
+            }
+
+            //Denoiser
+            ImGui::Checkbox("Denoise", &denoising);
+            if (denoising) {
+                ImGui::SliderInt("Filter Passes", &denoise_iterations, 1, denoise_max_iterations);
+                float color_sigma = (float)denoise_color_sigma;
+                if (ImGui::SliderFloat("Color Sigma", &color_sigma, 0.1f, 10.0f, "%.2f")) {
+                    denoise_color_sigma = color_sigma;
+                }
+                float depth_sigma = (float)denoise_depth_sigma;
+                if (ImGui::SliderFloat("Depth Sigma", &depth_sigma, 0.001f, 1.0f, "%.3f")) {
+                    denoise_depth_sigma = depth_sigma;
+                }
+                ImGui::Text("Denoise: %.2f ms", render_stats.denoise_ms);
+            }
+
             //Max bounces
             ImGui::InputInt("Max Bounces", &max_bounces);
             if (max_bounces < 1){
                 max_bounces = 1;
             } 
 
+            //Sample pattern
+            const char* sampler_names[] = {"Random", "Sobol", "Blue Noise"};
+            int sampler_index = sampler_type;
+            if (ImGui::Combo("Sampler", &sampler_index, sampler_names, 3)) {
+                sampler_type = (SamplerType)sampler_index;
+            }
+
+            //Render threads
+            ImGui::InputInt("Threads", &thread_count);
+            if (thread_count < 1) {
+                thread_count = 1;
+            }
+            double mrays_per_second = render_stats.frame_ms > 0
+                ? render_stats.ray_count / (render_stats.frame_ms * 1000.0) : 0.0;
+            ImGui::Text("Frame: %.2f ms, %.2f Mrays/s", render_stats.frame_ms, mrays_per_second);
+
+            //Dynamic resolution
+            ImGui::Checkbox("Dynamic Resolution", &dynamic_resolution);
+            if (dynamic_resolution) {
+                ImGui::SliderFloat("Target Frame (ms)", &target_frame_ms, 5.0f, 100.0f, "%.1f");
+                ImGui::Text("Resolution: %dx%d", image_width, image_height);
+            }
+            ImGui::Text("SIMD kernels: %s (%d wide)", kernels.isa, kernels.simd_width);
+
             ImGui::End();
         }
 
@@ -353,6 +548,7 @@ int main() {
         glClear(GL_COLOR_BUFFER_BIT);
         // render here:
         if (!render_pause) {
+            choose_resolution();
             render(framebuffer, scene, object_count);
         }
         update_framebuffer(framebuffer);
@@ -372,6 +568,7 @@ int main() {
     glfwTerminate();
 
     delete[] framebuffer;
+    delete[] scene;
 
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
@@ -0,0 +1,128 @@
+#include "packet.h"
+#include "bvh.h"
+#include "sphere_pool.h"
+#include "raytracer.h"
+
+#include <cmath>
+#include <limits>
+
+void clear_packet(RayPacket& packet, const Vec3& origin) {
+    packet.origin = origin;
+    packet.active = 0;
+    for (int i = 0; i < packet_rays; i++) {
+        // inactive rays keep t at 0, below tmin, so no box or sphere test can pass for them
+        packet.direction_x[i] = packet.direction_y[i] = packet.direction_z[i] = 1.0f;
+        packet.inverse_x[i] = packet.inverse_y[i] = packet.inverse_z[i] = 1.0f;
+        packet.t[i] = 0.0f;
+        packet.slot[i] = -1.0f;
+    }
+}
+
+void set_packet_ray(RayPacket& packet, int index, const Vec3& ray_direction) {
+    Vec3 direction = normalize(ray_direction);
+    packet.direction_x[index] = direction.x;
+    packet.direction_y[index] = direction.y;
+    packet.direction_z[index] = direction.z;
+    packet.inverse_x[index] = 1.0f / (float)direction.x;
+    packet.inverse_y[index] = 1.0f / (float)direction.y;
+    packet.inverse_z[index] = 1.0f / (float)direction.z;
+    packet.t[index] = std::numeric_limits<float>::infinity();
+    packet.active |= 1 << index;
+}
+
+// Anything that is not a sphere goes through Object::hit() one ray at a time
+static void hit_packet_object(RayPacket& packet, const Object& object, int slot, float tmin) {
+    for (int i = 0; i < packet_rays; i++) {
+        if (!(packet.active & (1 << i))) {
+            continue;
+        }
+        // unit direction, so the t that comes back is a distance like the rest of the packet's
+        Ray ray(packet.origin, Vec3(packet.direction_x[i], packet.direction_y[i], packet.direction_z[i]));
+        HitRecord hit_record;
+        if (object.hit(ray, tmin, packet.t[i], hit_record)) {
+            packet.t[i] = (float)hit_record.t;
+            packet.slot[i] = (float)slot;
+        }
+    }
+}
+
+// Spheres go through the kernel all at once, anything else one slot at a time after it. Both
+// only lower t, so the order does not change which hit wins.
+static void hit_packet_slots(RayPacket& packet, const SpherePool& pool, const Object scene[], int first, int count,
+                             const float origin[3], float tmin) {
+    kernels.hit_packet_spheres(packet, sphere_arrays(pool), first, count, origin, tmin);
+    if (pool.others_before[first + count] == pool.others_before[first]) {
+        return;
+    }
+    for (int slot = first; slot < first + count; slot++) {
+        if (pool.radius2[slot] < 0) {
+            hit_packet_object(packet, scene[pool.objects[slot]], slot, tmin);
+        }
+    }
+}
+
+// True when any ray enters box before its current nearest hit
+static bool packet_hits_box(const RayPacket& packet, const AABB& box, float tmin) {
+    float relative[6] = {
+        (float)(box.min.x - packet.origin.x), (float)(box.min.y - packet.origin.y),
+        (float)(box.min.z - packet.origin.z), (float)(box.max.x - packet.origin.x),
+        (float)(box.max.y - packet.origin.y), (float)(box.max.z - packet.origin.z),
+    };
+    return kernels.packet_hits_box(packet, relative, tmin);
+}
+
+static double axis(const Vec3& vec, int index) {
+    return index == 0 ? vec.x : index == 1 ? vec.y : vec.z;
+}
+
+void trace_packet(RayPacket& packet, const BVH& bvh, const SpherePool& pool, const Object scene[], bool use_bvh,
+                  float tmin) {
+    if (packet.active == 0) {
+        return;
+    }
+    float origin[3] = {(float)packet.origin.x, (float)packet.origin.y, (float)packet.origin.z};
+    if (!use_bvh) {
+        hit_packet_slots(packet, pool, scene, 0, pool.count, origin, tmin);
+        return;
+    }
+    if (bvh.nodes.empty()) {
+        return;
+    }
+
+    // children are visited in the order the first active ray would meet them
+    int first_ray = 0;
+    while (!(packet.active & (1 << first_ray))) {
+        first_ray++;
+    }
+    Vec3 lead_direction(packet.direction_x[first_ray], packet.direction_y[first_ray],
+                        packet.direction_z[first_ray]);
+
+    int stack[bvh_max_depth + 1];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0) {
+        const BVHNode& node = bvh.nodes[stack[--stack_size]];
+        if (!packet_hits_box(packet, node.bounds, tmin)) {
+            continue;
+        }
+        if (node.is_leaf()) {
+            hit_packet_slots(packet, pool, scene, node.left_first, node.count, origin, tmin);
+            continue;
+        }
+
+        const BVHNode& left = bvh.nodes[node.left_first];
+        const BVHNode& right = bvh.nodes[node.left_first + 1];
+        Vec3 separation = right.bounds.centroid() - left.bounds.centroid();
+        int split_axis = 0;
+        if (std::abs(separation.y) > std::abs(axis(separation, split_axis))) {
+            split_axis = 1;
+        }
+        if (std::abs(separation.z) > std::abs(axis(separation, split_axis))) {
+            split_axis = 2;
+        }
+        bool left_first = axis(separation, split_axis) * axis(lead_direction, split_axis) >= 0;
+        // push the far child first
+        stack[stack_size++] = left_first ? node.left_first + 1 : node.left_first;
+        stack[stack_size++] = left_first ? node.left_first : node.left_first + 1;
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef PACKET_H
+#define PACKET_H
+
+#include "kernels.h"
+#include "render.h"
+
+struct BVH;
+struct SpherePool;
+struct Object;
+
+// Camera rays of one pixel block, traced through the scene together. They all start at the
+// camera, so only directions are stored per ray, in the SoA lanes the kernels work on.
+struct RayPacket : PacketLanes {
+    Vec3 origin;
+    int active; // bit i set when ray i is in use. Blocks cut off by the image border have gaps.
+};
+
+// Sets ray index's direction (normalized on the way in) and marks it active
+void set_packet_ray(RayPacket& packet, int index, const Vec3& direction);
+void clear_packet(RayPacket& packet, const Vec3& origin);
+
+// Finds the nearest sphere pool slot hit by every active ray, walking the BVH with the whole
+// packet at once. A node is entered when any active ray enters it before its own nearest hit.
+// Slots that are not spheres are tested against scene one ray at a time. tmin is a distance.
+void trace_packet(RayPacket& packet, const BVH& bvh, const SpherePool& pool, const Object scene[], bool use_bvh,
+                  float tmin);
+
+#endif // !PACKET_H
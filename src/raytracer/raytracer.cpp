@@ -1,8 +1,18 @@
 #include "raytracer.h"
 #include "render.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <future>
 #include <limits>
+#include <vector>
+
+#include "denoise.h"
+#include "kernels.h"
+#include "packet.h"
+#include "thread_pool.h"
 
 Vec3 camera(0, 0, 3);
 Vec3 camera_direction = normalize(Vec3(0, 0, 1));
@@ -11,10 +21,391 @@ Vec3 right = cross(camera_direction, up);
 double focal_length = 3; // this feels pretty good for now. can tweak if needed
 int samples_per_pixel = 1;
 int max_bounces = 5;
+int thread_count = hardware_thread_count();
+RenderStats render_stats;
+bool accumulate = true;
+int accumulated_samples = 0;
+bool use_bvh = true;
+bool packet_tracing = true;
+bool adaptive_sampling = false;
+double adaptive_threshold = 0.02;
+int adaptive_min_samples = 8;
+bool denoising = false;
+int denoise_iterations = 4;
+double denoise_color_sigma = 2.0;
+double denoise_depth_sigma = 0.02;
+SamplerType sampler_type = SobolSampler;
+int image_width = width;
+int image_height = height;
+double bvh_rebuild_threshold = 1.25;
+BVH scene_bvh;
+SpherePool sphere_pool;
+
+static_assert(sizeof(Color) == 3, "the framebuffer is resolved as rgb bytes");
+
+// Running sum of every sample since the last reset, rgb interleaved. The framebuffer shows the mean.
+static std::vector<float> accumulation;
+// Samples in each pixel's sum, which differ between pixels with adaptive sampling, and the sum
+// and squared sum of their luminance (0..1) for the variance estimate. Reset with accumulation.
+static std::vector<int> pixel_samples;
+static std::vector<double> luminance_sums;
+static std::vector<double> luminance_squares;
+
+// Sums of what each sample's camera ray hit first, the guides for the denoiser. Misses count the
+// sky as albedo, the way back along the ray as normal and sky_depth as depth.
+struct GuideSums {
+    float albedo[3];
+    float normal[3];
+    float depth;
+};
+static std::vector<GuideSums> guide_sums;
+constexpr double sky_depth = 1e4;
+static DenoiseBuffers denoise_buffers;
+static std::vector<std::vector<float>> denoise_rows; // per worker
+// The last render() ran denoise_frame(), so denoise_buffers hold its picture
+static bool frame_denoised = false;
+
+// What the accumulation buffer was rendered with, to notice when the picture is out of date.
+static Vec3 accumulated_camera;
+static Vec3 accumulated_camera_direction;
+static int accumulated_max_bounces;
+static SamplerType accumulated_sampler_type;
+static bool accumulated_adaptive;
+
+// Copy of the scene scene_bvh was built (or last refitted) for, and the bounds it used
+static std::vector<Object> scene_snapshot;
+static std::vector<AABB> scene_bounds;
+
+static bool same_object(const Object& left, const Object& right) {
+    return left.object_type == right.object_type && left.center == right.center &&
+           left.radius == right.radius && left.color == right.color &&
+           left.blas == right.blas && left.cos_yaw == right.cos_yaw && left.sin_yaw == right.sin_yaw;
+}
+
+// Fills changed with the objects that differ from scene_snapshot. Returns false when refitting
+// can't catch up and the scene needs a full build: objects were added or removed, or one changed
+// type (the sphere pool keeps spheres and everything else apart).
+static bool find_changes(const Object scene[], int object_count, std::vector<int>& changed) {
+    changed.clear();
+    if (object_count != (int)scene_snapshot.size()) {
+        return false;
+    }
+    for (int i = 0; i < object_count; i++) {
+        if (!same_object(scene[i], scene_snapshot[i])) {
+            if (scene[i].object_type != scene_snapshot[i].object_type) {
+                return false;
+            }
+            changed.push_back(i);
+        }
+    }
+    return true;
+}
+
+void reset_accumulation() {
+    accumulated_samples = 0;
+}
+
+// An instance is a ray transform plus a walk down its own BVH, which makes it far more
+// expensive than one sphere. Telling the top level build keeps instances out of shared leaves.
+constexpr double instance_cost = 10.0;
+
+// Everything a full build makes, so it can be made off to the side and swapped in
+struct SceneBuild {
+    BVH bvh;
+    SpherePool pool;
+    std::vector<Object> snapshot;
+    std::vector<AABB> bounds;
+    int generation; // of the synchronous builds when this one started
+};
+
+// A rebuild started when refitting wore the tree down, and how many synchronous builds there
+// were so far. Those replace the scene outright, so an older background build is dropped.
+static std::future<SceneBuild> background_build;
+static int scene_generation = 0;
+
+static void start_scene_build(SceneBuild& build, const Object scene[], int object_count) {
+    build.snapshot.assign(scene, scene + object_count);
+    build.generation = scene_generation;
+    // instance bounds read mesh_bvhs, which can grow under a background build, so bounds come first
+    build.bounds.resize(object_count);
+    for (int i = 0; i < object_count; i++) {
+        build.bounds[i] = scene[i].bounds();
+    }
+}
+
+static void build_scene_into(SceneBuild& build) {
+    int object_count = (int)build.snapshot.size();
+    std::vector<double> costs(object_count);
+    for (int i = 0; i < object_count; i++) {
+        costs[i] = build.snapshot[i].object_type == Sphere ? 1.0 : instance_cost;
+    }
+    build_bvh(build.bvh, build.bounds.data(), object_count, costs.data());
+    build_sphere_pool(build.pool, build.snapshot.data(), build.bvh.indices.data(), object_count);
+}
+
+static void install_scene(SceneBuild& build) {
+    std::swap(scene_bvh, build.bvh);
+    std::swap(sphere_pool, build.pool);
+    std::swap(scene_snapshot, build.snapshot);
+    std::swap(scene_bounds, build.bounds);
+}
+
+void build_scene(const Object scene[], int object_count) {
+    SceneBuild build;
+    start_scene_build(build, scene, object_count);
+    build_scene_into(build);
+    install_scene(build);
+    scene_generation++;
+}
+
+// Brings scene_bvh and sphere_pool up to date with scene and returns whether anything changed.
+// Edits to existing objects refit the tree in place instead of rebuilding it.
+static bool update_scene(const Object scene[], int object_count) {
+    if (background_build.valid() &&
+        background_build.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        // edits made while it was building are refitted into it below like any other
+        SceneBuild build = background_build.get();
+        if (build.generation == scene_generation) {
+            install_scene(build);
+        }
+    }
+
+    static std::vector<int> changed;
+    if (!find_changes(scene, object_count, changed)) {
+        build_scene(scene, object_count);
+        render_stats.refit_ms = 0;
+        return true;
+    }
+    if (changed.empty()) {
+        return false;
+    }
+
+    auto refit_start = std::chrono::steady_clock::now();
+    for (int i : changed) {
+        scene_snapshot[i] = scene[i];
+        scene_bounds[i] = scene[i].bounds();
+        update_pool_slot(sphere_pool, sphere_pool.slots[i], scene[i]);
+    }
+    refit_bvh(scene_bvh, scene_bounds.data(), changed.data(), (int)changed.size());
+    render_stats.refit_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - refit_start).count();
+
+    if (bvh_quality(scene_bvh) > bvh_rebuild_threshold && !background_build.valid()) {
+        SceneBuild build;
+        start_scene_build(build, scene, object_count);
+        background_build = std::async(std::launch::async, [build = std::move(build)]() mutable {
+            build_scene_into(build);
+            return std::move(build);
+        });
+    }
+    return true;
+}
+
+// Background gradient, 0..255
+static Vec3 sky_color(const Vec3& direction) {
+    Vec3 unit_direction = normalize(direction);
+    double a = 0.5 * (unit_direction.y + 1.0);
+    return Vec3(((1 - a) + a * 0.5) * 255, ((1 - a) + a * 0.7) * 255, ((1 - a) + a * 1.0) * 255);
+}
+
+// Follows a camera ray through its diffuse bounces and returns the color it carries back.
+// hit and hit_record are the ray's first intersection, which the caller already traced.
+static Vec3 trace_path(Ray ray, bool hit, HitRecord& hit_record, Sampler& sampler, Object scene[], int object_count,
+                       long long& ray_count) {
+    Vec3 color = sky_color(ray.direction);
+    ray_count++;
+
+    int bounce_count = 0;
+    while (hit && bounce_count < max_bounces) {
+        Vec3 direction = sample_cosine_hemisphere(hit_record.normal, sample_2d(sampler));
+        ray = Ray(hit_record.point, direction);
+        color = hit_record.color * color;
+        bounce_count++;
+        // the last bounce's color doesn't depend on what the ray hits next
+        if (bounce_count == max_bounces) {
+            break;
+        }
+        hit = hit_scene(ray, scene, object_count, hit_record);
+        ray_count++;
+    }
+    return color;
+}
+
+// Object hits leave a color to tint with the object's own (white for most)
+static Vec3 slot_color(int slot) {
+    return Vec3(sphere_pool.color_r[slot], sphere_pool.color_g[slot], sphere_pool.color_b[slot]);
+}
+
+// First hits of a block of camera rays (row stride packet_size) through one RayPacket, for the
+// rays whose bit is set in pixels. The packet only finds the nearest object; its hit record is
+// redone against that object alone.
+static void trace_camera_packet(const Ray rays[], int pixels, Object scene[], int object_count, bool hits[],
+                                HitRecord hit_records[]) {
+    RayPacket packet;
+    clear_packet(packet, camera);
+    for (int k = 0; k < packet_rays; k++) {
+        if (pixels & (1 << k)) {
+            set_packet_ray(packet, k, rays[k].direction);
+        }
+    }
+    trace_packet(packet, scene_bvh, sphere_pool, scene, use_bvh, 0.001f);
+
+    const double infinity = std::numeric_limits<double>::infinity();
+    for (int k = 0; k < packet_rays; k++) {
+        if (!(packet.active & (1 << k))) {
+            continue;
+        }
+        int slot = (int)packet.slot[k];
+        // the packet's tmin is a distance along the normalized direction, hit() wants a ray t
+        double tmin = 0.001 / magnitude(rays[k].direction);
+        hits[k] = slot >= 0 && scene[sphere_pool.objects[slot]].hit(rays[k], tmin, infinity, hit_records[k]);
+        if (hits[k]) {
+            hit_records[k].color = slot_color(slot) * hit_records[k].color;
+        } else if (slot >= 0) {
+            // float and double disagree about a grazing hit, trace this one alone
+            hits[k] = hit_scene(rays[k], scene, object_count, hit_records[k]);
+        }
+    }
+}
+
+// Adds what a camera ray hit first to a pixel's guide sums
+static void add_guides(GuideSums& guides, const Ray& ray, bool hit, const HitRecord& hit_record) {
+    Vec3 albedo = hit ? hit_record.color : sky_color(ray.direction) / 255;
+    Vec3 normal = hit ? normalize(hit_record.normal) : normalize(-1 * ray.direction);
+    guides.albedo[0] += albedo.x;
+    guides.albedo[1] += albedo.y;
+    guides.albedo[2] += albedo.z;
+    guides.normal[0] += normal.x;
+    guides.normal[1] += normal.y;
+    guides.normal[2] += normal.z;
+    guides.depth += hit ? hit_record.t * magnitude(ray.direction) : sky_depth;
+}
+
+// Relative standard error of the pixel's mean luminance is within adaptive_threshold. Dark
+// pixels are held to a floor instead of their own tiny mean, or noise too faint to see would
+// keep them sampling forever.
+static bool pixel_converged(int i) {
+    int n = pixel_samples[i];
+    if (n < std::max(adaptive_min_samples, 2)) {
+        return false;
+    }
+    double mean = luminance_sums[i] / n;
+    double variance = std::max(0.0, (luminance_squares[i] - luminance_sums[i] * mean) / (n - 1));
+    return std::sqrt(variance / n) <= adaptive_threshold * std::max(mean, 0.05);
+}
+
+// Every pixel of the block at (block_x, block_y) with its bit set in pixels has converged.
+// NOTE: blocks stop together, not pixels one by one. A pixel on the silhouette of a small sphere
+// can miss it with all of its first few samples and look noise free; its neighbours that did hit
+// it keep it sampling. Per pixel stopping measured twice the error for the same sample count.
+static bool block_converged(int block_x, int block_y, int pixels) {
+    for (int k = 0; k < packet_rays; k++) {
+        if ((pixels & (1 << k)) &&
+            !pixel_converged((block_y + k / packet_size) * image_width + block_x + k % packet_size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+constexpr int tile_size = 32;
+static ThreadPool pool;
+
+// Mean albedo of pixel i, what its color is divided by before filtering. Kept off zero so black
+// objects don't divide by it.
+static Vec3 mean_albedo(int i) {
+    const GuideSums& guides = guide_sums[i];
+    float scale = 1.0f / std::max(pixel_samples[i], 1);
+    return Vec3(std::max(guides.albedo[0] * scale, 1e-3f), std::max(guides.albedo[1] * scale, 1e-3f),
+                std::max(guides.albedo[2] * scale, 1e-3f));
+}
+
+// Filtered linear color of row y (1 is full white), with the albedo multiplied back in
+static void denoised_row(int y, float rgb[]) {
+    for (int x = 0; x < image_width; x++) {
+        int index = denoise_buffers.index(x, y);
+        Vec3 albedo = mean_albedo(y * image_width + x);
+        rgb[x * 3] = denoise_buffers.color[0][index] * albedo.x;
+        rgb[x * 3 + 1] = denoise_buffers.color[1][index] * albedo.y;
+        rgb[x * 3 + 2] = denoise_buffers.color[2][index] * albedo.z;
+    }
+}
+
+// Runs the a-trous filter over the accumulated means and writes the result to framebuffer
+static void denoise_frame(Color framebuffer[]) {
+    denoise_buffers.resize(image_width, image_height);
+    pool.parallel_for(image_height, [&](int y, int) {
+        for (int x = 0; x < image_width; x++) {
+            int i = y * image_width + x;
+            int index = denoise_buffers.index(x, y);
+            const GuideSums& guides = guide_sums[i];
+            float scale = 1.0f / std::max(pixel_samples[i], 1);
+            Vec3 albedo = mean_albedo(i);
+            Vec3 normal(guides.normal[0], guides.normal[1], guides.normal[2]);
+            normal = magnitude(normal) > 0 ? normalize(normal) : normal;
+            denoise_buffers.color[0][index] = accumulation[i * 3] * scale / (255 * albedo.x);
+            denoise_buffers.color[1][index] = accumulation[i * 3 + 1] * scale / (255 * albedo.y);
+            denoise_buffers.color[2][index] = accumulation[i * 3 + 2] * scale / (255 * albedo.z);
+            denoise_buffers.normal[0][index] = normal.x;
+            denoise_buffers.normal[1][index] = normal.y;
+            denoise_buffers.normal[2][index] = normal.z;
+            denoise_buffers.depth[index] = guides.depth * scale;
+            denoise_buffers.samples[index] = (float)pixel_samples[i];
+        }
+    });
+    // the filter narrows color_sigma by each pixel's own sample count, which differ with adaptive
+    // sampling
+    denoise(denoise_buffers, pool, denoise_iterations, (float)denoise_color_sigma, (float)denoise_depth_sigma);
+
+    denoise_rows.resize(pool.size());
+    pool.parallel_for(image_height, [&](int y, int worker) {
+        std::vector<float>& row = denoise_rows[worker];
+        row.resize((size_t)image_width * 3);
+        denoised_row(y, row.data());
+        for (float& value : row) {
+            value *= 255;
+        }
+        kernels.resolve_pixels(row.data(), &framebuffer[y * image_width].r, image_width * 3, 1.0f);
+    });
+}
 
 void render(Color framebuffer[], Object scene[], int object_count) {
+    auto frame_start = std::chrono::steady_clock::now();
+    pool.resize(thread_count);
+    thread_count = pool.size();
+
+    bool scene_changed = update_scene(scene, object_count);
+    render_stats.bvh_rebuilding = background_build.valid();
+    size_t pixel_count = (size_t)image_width * image_height;
+    bool resized = accumulation.size() != pixel_count * 3;
+    if (resized) {
+        accumulation.resize(pixel_count * 3);
+        pixel_samples.resize(pixel_count);
+        luminance_sums.resize(pixel_count);
+        luminance_squares.resize(pixel_count);
+        guide_sums.resize(pixel_count);
+    }
+    // NOTE: toggling adaptive sampling starts over too, so with it off every pixel has the same
+    // sample count and the framebuffer can be resolved a row at a time
+    if (!accumulate || resized || scene_changed || accumulated_samples == 0 || !(camera == accumulated_camera) ||
+        !(camera_direction == accumulated_camera_direction) || max_bounces != accumulated_max_bounces ||
+        sampler_type != accumulated_sampler_type || adaptive_sampling != accumulated_adaptive) {
+        std::fill(accumulation.begin(), accumulation.end(), 0.0f);
+        std::fill(pixel_samples.begin(), pixel_samples.end(), 0);
+        std::fill(luminance_sums.begin(), luminance_sums.end(), 0.0);
+        std::fill(luminance_squares.begin(), luminance_squares.end(), 0.0);
+        std::fill(guide_sums.begin(), guide_sums.end(), GuideSums{});
+        accumulated_samples = 0;
+        accumulated_camera = camera;
+        accumulated_camera_direction = camera_direction;
+        accumulated_max_bounces = max_bounces;
+        accumulated_sampler_type = sampler_type;
+        accumulated_adaptive = adaptive_sampling;
+    }
+    int total_samples = accumulated_samples + samples_per_pixel;
+
     double viewport_height = 2.0;
-    double viewport_width = viewport_height * aspect_ratio;
+    double viewport_width = viewport_height * image_width / image_height;
 
     // from https://raytracing.github.io/
     // For the raytracer we use right handed coordinates. Positive x is to the right,
@@ -28,58 +419,200 @@ void render(Color framebuffer[], Object scene[], int object_count) {
     u = viewport_width * u;
     v = -viewport_height * v;
 
-    Vec3 du = u / width;
-    Vec3 dv = v / height;
+    Vec3 du = u / image_width;
+    Vec3 dv = v / image_height;
 
     Vec3 viewport_origin = camera - (focal_length * w) - u / 2 - v / 2;
     Vec3 pixel_origin = viewport_origin + 0.5 * (du + dv);
 
-    for (int i = 0; i < width * height; i++) {
-        Vec3 color_total(0, 0, 0);
-        for (int j = 0; j < samples_per_pixel; j++) {
-            double random_in_square = random_double() - 0.5;
-            Vec3 pixel_center = pixel_origin + (((i % width) + random_in_square) * du) +
-                ((((int)(i / width)) + random_in_square) * dv);
-            Vec3 ray_direction = pixel_center - camera;
-
-            Vec3 unit_direction = normalize(ray_direction);
-            double a = 0.5 * (unit_direction.y + 1.0);
-
-            int bounce_count = 0;
-            Ray ray(camera, ray_direction);
-            Vec3 color(((1 - a) + a * 0.5) * 255, ((1 - a) + a * 0.7) * 255, ((1 - a) + a * 1.0) * 255);
-            HitRecord hit_record;
-            while (hit_scene(ray, scene, object_count, hit_record) && bounce_count < max_bounces) {
-                // TODO(Ben): The way we are doing random vector seeding is causing the visual artifacts
-                Vec3 direction = random_vector() + hit_record.normal;
-                /*if (dot(direction, hit_record.normal) < 0) {
-                    direction = -1 * direction;
-                }*/
-                ray = Ray(hit_record.point, direction);
-                color = hit_record.color * color;
-                bounce_count++;
+    int tiles_x = (image_width + tile_size - 1) / tile_size;
+    int tiles_y = (image_height + tile_size - 1) / tile_size;
+    std::atomic<long long> ray_count(0);
+    std::atomic<long long> sample_count(0);
+
+    pool.parallel_for(tiles_x * tiles_y, [&](int tile, int) {
+        int x0 = (tile % tiles_x) * tile_size;
+        int y0 = (tile / tiles_x) * tile_size;
+        int x1 = std::min(x0 + tile_size, image_width);
+        int y1 = std::min(y0 + tile_size, image_height);
+        long long tile_rays = 0;
+        long long tile_samples = 0;
+
+        // blocks of packet_size x packet_size pixels, the unit of packet tracing
+        for (int block_y = y0; block_y < y1; block_y += packet_size) {
+            for (int block_x = x0; block_x < x1; block_x += packet_size) {
+                int block_width = std::min(packet_size, x1 - block_x);
+                int block_height = std::min(packet_size, y1 - block_y);
+                Vec3 color_total[packet_rays];
+                int pixels = 0; // pixels of the block inside the image
+                for (int by = 0; by < block_height; by++) {
+                    for (int bx = 0; bx < block_width; bx++) {
+                        int k = by * packet_size + bx;
+                        color_total[k] = Vec3(0, 0, 0);
+                        pixels |= 1 << k;
+                    }
+                }
+
+                for (int j = 0; j < samples_per_pixel; j++) {
+                    if (adaptive_sampling && block_converged(block_x, block_y, pixels)) {
+                        break;
+                    }
+                    Ray rays[packet_rays];
+                    Sampler samplers[packet_rays];
+                    bool hits[packet_rays];
+                    HitRecord hit_records[packet_rays];
+                    for (int k = 0; k < packet_rays; k++) {
+                        if (!(pixels & (1 << k))) {
+                            continue;
+                        }
+                        int x = block_x + k % packet_size;
+                        int y = block_y + k / packet_size;
+                        samplers[k] = start_sample(sampler_type, x, y, pixel_samples[y * image_width + x]);
+                        Vec2 jitter = sample_2d(samplers[k]);
+                        Vec3 pixel_center = pixel_origin + ((x + jitter.x - 0.5) * du) + ((y + jitter.y - 0.5) * dv);
+                        rays[k] = Ray(camera, pixel_center - camera);
+                    }
+
+                    if (packet_tracing) {
+                        trace_camera_packet(rays, pixels, scene, object_count, hits, hit_records);
+                    } else {
+                        for (int k = 0; k < packet_rays; k++) {
+                            if (pixels & (1 << k)) {
+                                hits[k] = hit_scene(rays[k], scene, object_count, hit_records[k]);
+                            }
+                        }
+                    }
+
+                    for (int k = 0; k < packet_rays; k++) {
+                        if (!(pixels & (1 << k))) {
+                            continue;
+                        }
+                        int i = (block_y + k / packet_size) * image_width + block_x + k % packet_size;
+                        add_guides(guide_sums[i], rays[k], hits[k], hit_records[k]);
+                        Vec3 color = trace_path(rays[k], hits[k], hit_records[k], samplers[k], scene, object_count,
+                                                tile_rays);
+                        color_total[k] = color_total[k] + color;
+                        double luminance = (0.2126 * color.x + 0.7152 * color.y + 0.0722 * color.z) / 255;
+                        pixel_samples[i]++;
+                        luminance_sums[i] += luminance;
+                        luminance_squares[i] += luminance * luminance;
+                        tile_samples++;
+                    }
+                }
+
+                for (int by = 0; by < block_height; by++) {
+                    for (int bx = 0; bx < block_width; bx++) {
+                        int i = (block_y + by) * image_width + block_x + bx;
+                        const Vec3& color = color_total[by * packet_size + bx];
+                        float* sum = &accumulation[i * 3];
+                        sum[0] += color.x;
+                        sum[1] += color.y;
+                        sum[2] += color.z;
+                    }
+                }
+            }
+        }
+        // the tile's new means, a row at a time while every pixel has the same sample count
+        for (int y = y0; y < y1 && !denoising; y++) {
+            int i = y * image_width + x0;
+            if (!adaptive_sampling) {
+                kernels.resolve_pixels(&accumulation[i * 3], &framebuffer[i].r, (x1 - x0) * 3, (float)total_samples);
+                continue;
+            }
+            for (int x = x0; x < x1; x++, i++) {
+                kernels.resolve_pixels(&accumulation[i * 3], &framebuffer[i].r, 3, (float)pixel_samples[i]);
             }
-            color_total = color_total + color;
         }
-        framebuffer[i] = Color(color_total.x / samples_per_pixel,
-                               color_total.y / samples_per_pixel,
-                               color_total.z / samples_per_pixel);
+        ray_count += tile_rays;
+        sample_count += tile_samples;
+    });
+
+    accumulated_samples = total_samples;
+    render_stats.denoise_ms = 0;
+    frame_denoised = denoising;
+    if (denoising) {
+        auto denoise_start = std::chrono::steady_clock::now();
+        denoise_frame(framebuffer);
+        render_stats.denoise_ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - denoise_start).count();
     }
+    render_stats.ray_count = ray_count;
+    render_stats.sample_count = sample_count;
+    render_stats.samples_saved = (long long)pixel_count * samples_per_pixel - sample_count;
+    render_stats.frame_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - frame_start).count();
 }
 
-bool hit_scene(const Ray& ray, Object scene[], int object_count, HitRecord& hit_record) {
+void accumulated_image(float rgb[]) {
+    for (size_t i = 0; i < pixel_samples.size(); i++) {
+        float scale = pixel_samples[i] > 0 ? 1.0f / (255.0f * pixel_samples[i]) : 0.0f;
+        for (int channel = 0; channel < 3; channel++) {
+            rgb[i * 3 + channel] = accumulation[i * 3 + channel] * scale;
+        }
+    }
+}
+
+void denoised_image(float rgb[]) {
+    if (!frame_denoised) {
+        accumulated_image(rgb);
+        return;
+    }
+    for (int y = 0; y < image_height; y++) {
+        denoised_row(y, &rgb[(size_t)y * image_width * 3]);
+    }
+}
+
+// Runs the SIMD kernel over pool slots [first, first + count) and redoes the nearest hit in
+// double precision to fill in hit_record. Meshes in the run are tested one by one after that.
+static bool hit_slots(int first, int count, const Ray& ray, const PoolRay& pool_ray, const Object scene[],
+                      double& closest, HitRecord& hit_record) {
     bool hit = false;
-    double closest = std::numeric_limits<double>::infinity();
-    for (int j = 0; j < object_count; j++) {
-        if (scene[j].hit(ray, 0.001, closest, hit_record)) {
+    float t;
+    int slot = hit_spheres(sphere_pool, first, count, pool_ray, 0.001f, (float)closest, t);
+    if (slot >= 0) {
+        if (!scene[sphere_pool.objects[slot]].hit(ray, 0.001, closest, hit_record)) {
+            // float and double disagree about a grazing hit, let the double test settle the whole run
+            slot = -1;
+            for (int i = first; i < first + count; i++) {
+                if (sphere_pool.radius2[i] >= 0 && scene[sphere_pool.objects[i]].hit(ray, 0.001, closest, hit_record)) {
+                    closest = hit_record.t;
+                    slot = i;
+                }
+            }
+        }
+        if (slot >= 0) {
+            closest = hit_record.t;
+            hit_record.color = slot_color(slot) * hit_record.color;
             hit = true;
+        }
+    }
+
+    const std::vector<int>& others_before = sphere_pool.others_before;
+    if (others_before[first + count] == others_before[first]) {
+        return hit;
+    }
+    for (int i = first; i < first + count; i++) {
+        if (sphere_pool.radius2[i] < 0 && scene[sphere_pool.objects[i]].hit(ray, 0.001, closest, hit_record)) {
             closest = hit_record.t;
-            hit_record.color = scene[j].color;
+            hit_record.color = slot_color(i) * hit_record.color;
+            hit = true;
         }
     }
     return hit;
 }
 
+bool hit_scene(const Ray& ray, Object scene[], int object_count, HitRecord& hit_record) {
+    double closest = std::numeric_limits<double>::infinity();
+    PoolRay pool_ray = make_pool_ray(ray);
+    if (!use_bvh) {
+        return hit_slots(0, sphere_pool.count, ray, pool_ray, scene, closest, hit_record);
+    }
+    // leaves are contiguous runs of pool slots
+    return traverse_bvh(scene_bvh, ray.origin, ray.direction, 0.001, closest, [&](int first, int count) {
+        return hit_slots(first, count, ray, pool_ray, scene, closest, hit_record);
+    });
+}
+
 bool hit_sphere(const Vec3& center, double radius,
                 const Ray& ray, double tmin, double tmax, HitRecord& hit_record) {
     Vec3 to_sphere = center - ray.origin;
@@ -101,6 +634,7 @@ bool hit_sphere(const Vec3& center, double radius,
     }
     
     hit_record.t = root;
+    hit_record.color = Vec3(1, 1, 1);
     hit_record.point = ray.at(root);
     hit_record.normal = (hit_record.point - center) / radius;
     hit_record.front_face = dot(ray.direction, hit_record.normal) < 0;
@@ -1,20 +1,39 @@
 #ifndef RAYTRACER_H
 #define RAYTRACER_H
 
-#include <random>
+#include <cmath>
+#include <cstdint>
 
 #include "render.h"
+#include "bvh.h"
+#include "sphere_pool.h"
+#include "sampler.h"
+#include "triangle_mesh.h"
+#include "instance.h"
+
+// PCG random numbers (https://www.pcg-random.org). Every camera sample seeds its own generator
+// from its pixel and sample index, and its bounces draw from that stream in order, so an image
+// comes out the same no matter how many threads rendered it or which tiles they picked up.
+struct Rng {
+    uint32_t state;
+};
 
-// TODO(Ben): potentially use pcg hash instead of trashy C++ random stl
+// PCG-RXS-M-XS, also good on its own as a hash for seeding
+static uint32_t pcg_hash(uint32_t input) {
+    uint32_t state = input * 747796405u + 2891336453u;
+    uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
 
-static double random_double() {
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
-    return distribution(generator);
+static Rng seed_rng(uint32_t pixel, uint32_t sample) {
+    return Rng{pcg_hash(pixel ^ pcg_hash(sample))};
 }
 
-static Vec3 random_vector() {
-    return normalize(Vec3(random_double() * 2 - 1, random_double() * 2 - 1, random_double() * 2 - 1));
+// uniform in [0, 1)
+static double random_double(Rng& rng) {
+    rng.state = rng.state * 747796405u + 2891336453u;
+    uint32_t word = ((rng.state >> ((rng.state >> 28u) + 4u)) ^ rng.state) * 277803737u;
+    return ((word >> 22u) ^ word) * (1.0 / 4294967296.0);
 }
 
 // a is start b is end
@@ -31,7 +50,9 @@ struct Ray {
 };
 
 enum ObjectType {
-    Sphere
+    Sphere,
+    TriangleMesh, // instance of mesh_bvhs[blas]
+    SphereSet     // instance of sphere_set_bvhs[blas]
 };
 
 struct HitRecord {
@@ -47,19 +68,39 @@ bool hit_sphere(const Vec3& center, double radius, const Ray& ray, double tmin,
 
 struct Object {
     ObjectType object_type;
-    Vec3 center;
-    double radius;
+    Vec3 center;   // instances: position of the instance origin
+    double radius; // instances: scale
     Vec3 color;
+    int blas;      // instances: index of the bottom level structure, -1 for spheres
+    double cos_yaw; // instances: turn around +y, kept as cosine and sine so rays don't pay for them
+    double sin_yaw;
 
     bool hit(const Ray& ray, double tmin, double tmax, HitRecord& hit_record) const {
         switch (object_type) {
             case Sphere: {
                 return hit_sphere(center, radius, ray, tmin, tmax, hit_record);
+            } case TriangleMesh:
+              case SphereSet: {
+                return hit_instance(*this, ray, tmin, tmax, hit_record);
             } default: {
                 return false;
             }
         }
     }
+
+    AABB bounds() const {
+        switch (object_type) {
+            case Sphere: {
+                Vec3 extent(radius, radius, radius);
+                return AABB(center - extent, center + extent);
+            } case TriangleMesh:
+              case SphereSet: {
+                return instance_bounds(*this);
+            } default: {
+                return AABB();
+            }
+        }
+    }
 };
 
 static Object create_sphere(Vec3 center, double radius, Color color) {
@@ -70,10 +111,53 @@ static Object create_sphere(Vec3 center, double radius, Color color) {
     object.color.x = color.r / 255.0;
     object.color.y = color.g / 255.0;
     object.color.z = color.b / 255.0;
+    object.blas = -1;
+    object.cos_yaw = 1;
+    object.sin_yaw = 0;
     return object;
 }
 
+// Instance of mesh (from add_mesh()) or sphere set (from add_sphere_set()). scale has to be positive.
+static Object create_instance(ObjectType object_type, int blas, Vec3 position, double scale, double yaw,
+                              Color color) {
+    Object object;
+    object.object_type = object_type;
+    object.center = position;
+    object.radius = scale;
+    object.color.x = color.r / 255.0;
+    object.color.y = color.g / 255.0;
+    object.color.z = color.b / 255.0;
+    object.blas = blas;
+    object.cos_yaw = std::cos(yaw);
+    object.sin_yaw = std::sin(yaw);
+    return object;
+}
+
+// Timings of the last render() call
+struct RenderStats {
+    double frame_ms = 0;
+    long long ray_count = 0;
+    long long sample_count = 0;  // camera samples taken
+    long long samples_saved = 0; // by adaptive sampling, against samples_per_pixel for every pixel
+    double denoise_ms = 0;       // part of frame_ms
+    double refit_ms = 0;         // last BVH refit after objects were edited
+    bool bvh_rebuilding = false; // a rebuild is running in the background
+};
+
+// Adds samples_per_pixel samples to the accumulation buffer (fewer for converged pixels with
+// adaptive_sampling) and writes the running mean to framebuffer. The buffer starts over by itself
+// when the camera, max_bounces, sampler_type, adaptive_sampling, the image size or the scene
+// change, and every frame while accumulate is off.
 void render(Color framebuffer[], Object scene[], int object_count);
+void reset_accumulation();
+// Mean of the accumulated samples as linear floats (1 is full white), rgb interleaved and
+// image_width * image_height pixels, for output that keeps more than 8 bits
+void accumulated_image(float rgb[]);
+// Same for the last denoised frame, or the plain mean if the last frame wasn't denoised
+void denoised_image(float rgb[]);
+// Rebuilds scene_bvh. render() calls this itself when objects are added or removed, and refits
+// the tree when they are only edited. Anyone calling hit_scene() directly has to call it first.
+void build_scene(const Object scene[], int object_count);
 bool hit_scene(const Ray& ray, Object scene[], int object_count, HitRecord& hit_record);
 
 extern Vec3 camera;
@@ -81,7 +165,30 @@ extern Vec3 camera_direction;
 extern Vec3 up;
 extern Vec3 right;
 extern double focal_length;
+extern int image_width;  // size of the framebuffer render() fills, the window size by default
+extern int image_height;
 extern int samples_per_pixel;
 extern int max_bounces;
+extern int thread_count;
+extern RenderStats render_stats;
+extern bool accumulate;
+extern int accumulated_samples;
+extern bool use_bvh;
+extern SamplerType sampler_type;
+extern bool packet_tracing; // trace camera rays in packets, bounces are always traced alone
+// Stop sampling a packet_size x packet_size block once the relative standard error of every
+// pixel's mean luminance is below adaptive_threshold, checked from adaptive_min_samples samples on
+extern bool adaptive_sampling;
+extern double adaptive_threshold;
+extern int adaptive_min_samples;
+// Run the a-trous filter of denoise.h over every frame, guided by first hit albedo, normal and
+// depth. denoise_color_sigma is for 1 sample and shrinks with each pixel's sample count.
+extern bool denoising;
+extern int denoise_iterations;
+extern double denoise_color_sigma;
+extern double denoise_depth_sigma;
+extern double bvh_rebuild_threshold; // rebuild in the background once refits make the BVH this much worse
+extern BVH scene_bvh;
+extern SpherePool sphere_pool;
 
 #endif // !RENDERER_H
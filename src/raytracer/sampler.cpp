@@ -0,0 +1,220 @@
+#include "sampler.h"
+#include "raytracer.h"
+
+#include <cmath>
+#include <vector>
+
+constexpr double pi = 3.141592653589793238462643383;
+
+static uint32_t reverse_bits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// The first two Sobol dimensions: van der Corput and its (0,2) partner
+static uint32_t sobol_0(uint32_t index) {
+    return reverse_bits(index);
+}
+
+static uint32_t sobol_1(uint32_t index) {
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1) {
+        if (index & 1) {
+            result ^= v;
+        }
+    }
+    return result;
+}
+
+// Hash based Owen scrambling from Burley, "Practical Hash-based Owen Scrambling" (JCGT 2020)
+static uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+static uint32_t hash_combine(uint32_t seed, uint32_t value) {
+    return seed ^ (value + (seed << 6) + (seed >> 2));
+}
+
+static Vec2 scrambled_sobol_2d(uint32_t index, uint32_t seed) {
+    // shuffling the index too keeps padded dimensions from lining up with each other
+    index = nested_uniform_scramble(index, seed);
+    uint32_t x = nested_uniform_scramble(sobol_0(index), hash_combine(seed, 0));
+    uint32_t y = nested_uniform_scramble(sobol_1(index), hash_combine(seed, 1));
+    return Vec2(x * (1.0 / 4294967296.0), y * (1.0 / 4294967296.0));
+}
+
+constexpr int blue_noise_size = 64; // power of two, lookups wrap with a mask
+
+// Void and cluster (Ulichney 1993) over a toroidal blue_noise_size^2 tile. Returns every
+// pixel's rank as a value in [0, 1).
+static std::vector<float> generate_blue_noise() {
+    const int mask = blue_noise_size - 1;
+    const int pixel_count = blue_noise_size * blue_noise_size;
+    const double sigma = 1.5;
+
+    std::vector<float> kernel(pixel_count);
+    for (int y = 0; y < blue_noise_size; y++) {
+        for (int x = 0; x < blue_noise_size; x++) {
+            int dx = std::min(x, blue_noise_size - x);
+            int dy = std::min(y, blue_noise_size - y);
+            kernel[y * blue_noise_size + x] = std::exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+        }
+    }
+
+    std::vector<float> energy(pixel_count, 0.0f);
+    std::vector<char> on(pixel_count, 0);
+    auto toggle = [&](int pixel) {
+        on[pixel] = !on[pixel];
+        float sign = on[pixel] ? 1.0f : -1.0f;
+        int px = pixel % blue_noise_size;
+        int py = pixel / blue_noise_size;
+        for (int y = 0; y < blue_noise_size; y++) {
+            const float* row = &kernel[((y - py) & mask) * blue_noise_size];
+            for (int x = 0; x < blue_noise_size; x++) {
+                energy[y * blue_noise_size + x] += sign * row[(x - px) & mask];
+            }
+        }
+    };
+    // tightest cluster: the set pixel with the most energy, largest void: the empty one with the least
+    auto find = [&](bool set, bool most) {
+        int best = -1;
+        for (int i = 0; i < pixel_count; i++) {
+            if (on[i] == set && (best < 0 || (most ? energy[i] > energy[best] : energy[i] < energy[best]))) {
+                best = i;
+            }
+        }
+        return best;
+    };
+
+    // random initial pattern, then swap points from clusters into voids until it settles
+    int initial_count = pixel_count / 10;
+    Rng rng = seed_rng(0x9e3779b9u, 0);
+    for (int placed = 0; placed < initial_count;) {
+        int pixel = (int)(random_double(rng) * pixel_count);
+        if (!on[pixel]) {
+            toggle(pixel);
+            placed++;
+        }
+    }
+    while (true) {
+        int cluster = find(true, true);
+        toggle(cluster);
+        int void_pixel = find(false, false);
+        toggle(void_pixel);
+        if (void_pixel == cluster) {
+            break;
+        }
+    }
+    std::vector<char> initial_on = on;
+    std::vector<float> initial_energy = energy;
+
+    std::vector<int> rank(pixel_count);
+    // ranks below the initial pattern: take its points away tightest cluster first
+    for (int r = initial_count - 1; r >= 0; r--) {
+        int cluster = find(true, true);
+        toggle(cluster);
+        rank[cluster] = r;
+    }
+    // ranks above: fill the largest void every time. Past the halfway point this is the same as
+    // Ulichney's phase three, the emptiest pixel is also the tightest cluster of empty pixels.
+    on = initial_on;
+    energy = initial_energy;
+    for (int r = initial_count; r < pixel_count; r++) {
+        int void_pixel = find(false, false);
+        toggle(void_pixel);
+        rank[void_pixel] = r;
+    }
+
+    std::vector<float> tile(pixel_count);
+    for (int i = 0; i < pixel_count; i++) {
+        tile[i] = (rank[i] + 0.5f) / pixel_count;
+    }
+    return tile;
+}
+
+static const std::vector<float>& blue_noise() {
+    static const std::vector<float> tile = generate_blue_noise();
+    return tile;
+}
+
+static double fract(double x) {
+    return x - std::floor(x);
+}
+
+Sampler start_sample(SamplerType type, int x, int y, int sample) {
+    Sampler sampler;
+    sampler.type = type;
+    sampler.x = x;
+    sampler.y = y;
+    sampler.sample = sample;
+    sampler.dimension = 0;
+    sampler.rng_state = seed_rng(y * image_width + x, sample).state;
+    return sampler;
+}
+
+Vec2 sample_2d(Sampler& sampler) {
+    uint32_t dimension = sampler.dimension++;
+    switch (sampler.type) {
+        case SobolSampler: {
+            uint32_t pixel_seed = pcg_hash(sampler.x ^ pcg_hash(sampler.y));
+            return scrambled_sobol_2d(sampler.sample, pcg_hash(pixel_seed ^ pcg_hash(dimension)));
+        } case BlueNoiseSampler: {
+            // same sequence in every pixel, shifted (Cranley-Patterson) by blue noise values read at
+            // a different spot of the tile for every dimension and axis
+            const std::vector<float>& tile = blue_noise();
+            const int mask = blue_noise_size - 1;
+            uint32_t offset = pcg_hash(dimension);
+            float shift_x = tile[((sampler.y + (offset >> 8)) & mask) * blue_noise_size + ((sampler.x + offset) & mask)];
+            float shift_y = tile[((sampler.y + (offset >> 24)) & mask) * blue_noise_size + ((sampler.x + (offset >> 16)) & mask)];
+            Vec2 u = scrambled_sobol_2d(sampler.sample, pcg_hash(dimension + 1));
+            return Vec2(fract(u.x + shift_x), fract(u.y + shift_y));
+        } default: {
+            Rng rng{sampler.rng_state};
+            Vec2 u(random_double(rng), random_double(rng));
+            sampler.rng_state = rng.state;
+            return u;
+        }
+    }
+}
+
+Vec3 sample_cosine_hemisphere(const Vec3& normal, const Vec2& u) {
+    // Malley's method: a uniform point on the disk (Shirley-Chiu concentric map, which keeps the
+    // stratification of u) lifted onto the hemisphere
+    double a = 2 * u.x - 1;
+    double b = 2 * u.y - 1;
+    double r;
+    double phi;
+    if (a == 0 && b == 0) {
+        return normal;
+    } else if (a * a > b * b) {
+        r = a;
+        phi = (pi / 4) * (b / a);
+    } else {
+        r = b;
+        phi = (pi / 2) - (pi / 4) * (a / b);
+    }
+    double disk_x = r * std::cos(phi);
+    double disk_y = r * std::sin(phi);
+    double lift = std::sqrt(std::max(0.0, 1 - disk_x * disk_x - disk_y * disk_y));
+
+    // orthonormal basis around normal, Duff et al. "Building an Orthonormal Basis, Revisited"
+    double sign = std::copysign(1.0, normal.z);
+    double c = -1 / (sign + normal.z);
+    double d = normal.x * normal.y * c;
+    Vec3 tangent(1 + sign * normal.x * normal.x * c, sign * d, -sign * normal.x);
+    Vec3 bitangent(d, sign + normal.y * normal.y * c, -normal.y);
+    return disk_x * tangent + disk_y * bitangent + lift * normal;
+}
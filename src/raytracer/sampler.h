@@ -0,0 +1,33 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+
+#include "render.h"
+
+enum SamplerType {
+    RandomSampler,    // independent PCG numbers
+    SobolSampler,     // Owen scrambled Sobol (0,2) pairs, shuffled and scrambled per pixel
+    BlueNoiseSampler  // Sobol pairs rotated by a blue noise tile, so the error is spread as blue noise
+};
+
+// Hands out the 2D sample pairs of one camera sample: the first pair jitters the pixel, every
+// bounce after that takes the next one. Each pair is its own dimension so they don't correlate.
+struct Sampler {
+    SamplerType type;
+    uint32_t x;
+    uint32_t y;
+    uint32_t sample;    // sample index within the pixel
+    uint32_t dimension; // next 2D dimension
+    uint32_t rng_state; // only used by RandomSampler
+};
+
+Sampler start_sample(SamplerType type, int x, int y, int sample);
+// Next sample pair, both in [0, 1)
+Vec2 sample_2d(Sampler& sampler);
+
+// Cosine weighted direction around normal (which has to be unit length). Lambertian bounces
+// sampled this way carry exactly the surface albedo.
+Vec3 sample_cosine_hemisphere(const Vec3& normal, const Vec2& u);
+
+#endif // !SAMPLER_H
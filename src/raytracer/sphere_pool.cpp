@@ -0,0 +1,62 @@
+#include "sphere_pool.h"
+#include "raytracer.h"
+
+#include <limits>
+
+void build_sphere_pool(SpherePool& pool, const Object scene[], const int order[], int count) {
+    // pad by the widest vector so every kernel copy can load a full vector past the last slot
+    int padded = count + max_simd_width;
+    pool.center_x.assign(padded, 0.0f);
+    pool.center_y.assign(padded, 0.0f);
+    pool.center_z.assign(padded, 0.0f);
+    pool.radius2.assign(padded, -1.0f);
+    pool.color_r.assign(padded, 0.0f);
+    pool.color_g.assign(padded, 0.0f);
+    pool.color_b.assign(padded, 0.0f);
+    pool.objects.assign(count, -1);
+    pool.slots.assign(count, -1);
+    pool.others_before.assign(count + 1, 0);
+    pool.count = count;
+
+    for (int slot = 0; slot < count; slot++) {
+        const Object& object = scene[order[slot]];
+        pool.objects[slot] = order[slot];
+        pool.slots[order[slot]] = slot;
+        pool.others_before[slot + 1] = pool.others_before[slot] + (object.object_type != Sphere);
+        update_pool_slot(pool, slot, object);
+    }
+}
+
+void update_pool_slot(SpherePool& pool, int slot, const Object& object) {
+    pool.color_r[slot] = object.color.x;
+    pool.color_g[slot] = object.color.y;
+    pool.color_b[slot] = object.color.z;
+    if (object.object_type != Sphere) {
+        return;
+    }
+    pool.center_x[slot] = object.center.x;
+    pool.center_y[slot] = object.center.y;
+    pool.center_z[slot] = object.center.z;
+    pool.radius2[slot] = object.radius * object.radius;
+}
+
+PoolRay make_pool_ray(const Ray& ray) {
+    PoolRay pool_ray;
+    pool_ray.length = (float)magnitude(ray.direction);
+    Vec3 direction = ray.direction / pool_ray.length;
+    pool_ray.origin_x = (float)ray.origin.x;
+    pool_ray.origin_y = (float)ray.origin.y;
+    pool_ray.origin_z = (float)ray.origin.z;
+    pool_ray.direction_x = (float)direction.x;
+    pool_ray.direction_y = (float)direction.y;
+    pool_ray.direction_z = (float)direction.z;
+    return pool_ray;
+}
+
+SphereArrays sphere_arrays(const SpherePool& pool) {
+    return {pool.center_x.data(), pool.center_y.data(), pool.center_z.data(), pool.radius2.data()};
+}
+
+int hit_spheres(const SpherePool& pool, int first, int count, const PoolRay& ray, float tmin, float tmax, float& t) {
+    return kernels.hit_spheres(sphere_arrays(pool), first, count, ray, tmin, tmax, t);
+}
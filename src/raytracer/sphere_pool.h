@@ -0,0 +1,45 @@
+#ifndef SPHERE_POOL_H
+#define SPHERE_POOL_H
+
+#include <vector>
+
+#include "kernels.h"
+#include "simd.h"
+
+struct Object;
+struct Ray;
+
+// Structure-of-arrays copy of the scene spheres, in BVH leaf order so every leaf is one
+// contiguous run of slots. Kept in float so one vector instruction tests a vector of spheres.
+// Slots that are not spheres get radius2 = -1, which no ray can hit.
+// NOTE: the kernel tracks slot numbers in float lanes, which is exact up to 2^24 slots.
+struct SpherePool {
+    aligned_floats center_x;
+    aligned_floats center_y;
+    aligned_floats center_z;
+    aligned_floats radius2;
+    aligned_floats color_r;
+    aligned_floats color_g;
+    aligned_floats color_b;
+    std::vector<int> objects; // slot -> index into the scene array
+    std::vector<int> slots;   // index into the scene array -> slot
+    std::vector<int> others_before; // non-sphere slots before each slot, count + 1 entries
+    int count = 0;
+};
+
+// order[i] is the scene object stored in slot i
+void build_sphere_pool(SpherePool& pool, const Object scene[], const int order[], int count);
+// Copies an edited object into its slot. It has to keep its type.
+void update_pool_slot(SpherePool& pool, int slot, const Object& object);
+
+// Set up once per ray and reused for all the leaves it visits
+PoolRay make_pool_ray(const Ray& ray);
+
+// Pool arrays in the form the kernels take them
+SphereArrays sphere_arrays(const SpherePool& pool);
+
+// Nearest sphere in slots [first, first + count) hit by ray within (tmin, tmax), or -1.
+// t is set to the hit distance. Runs kernels.hit_spheres.
+int hit_spheres(const SpherePool& pool, int first, int count, const PoolRay& ray, float tmin, float tmax, float& t);
+
+#endif // !SPHERE_POOL_H
@@ -0,0 +1,133 @@
+#include "triangle_mesh.h"
+#include "kernels.h"
+#include "raytracer.h"
+
+#include <algorithm>
+#include <cmath>
+
+std::vector<MeshBVH> mesh_bvhs;
+
+// Rounded the way the kernel sees it, so the boxes hold the triangles that are actually tested
+static Vec3 to_float(const Vec3& vertex) {
+    return Vec3((float)vertex.x, (float)vertex.y, (float)vertex.z);
+}
+
+int add_mesh(const Mesh& mesh) {
+    // fan every face into triangles, skipping faces with indices outside the vertex list
+    std::vector<Vec3> triangles;
+    for (const std::vector<int>& face : mesh.faces) {
+        bool valid = face.size() >= 3;
+        for (int index : face) {
+            valid = valid && index >= 0 && index < (int)mesh.vertices.size();
+        }
+        if (!valid) {
+            continue;
+        }
+        for (int i = 1; i + 1 < (int)face.size(); i++) {
+            triangles.push_back(to_float(mesh.vertices[face[0]]));
+            triangles.push_back(to_float(mesh.vertices[face[i]]));
+            triangles.push_back(to_float(mesh.vertices[face[i + 1]]));
+        }
+    }
+
+    int count = (int)triangles.size() / 3;
+    if (count == 0) {
+        return -1;
+    }
+    MeshBVH mesh_bvh;
+    std::vector<AABB> bounds(count);
+    for (int i = 0; i < count; i++) {
+        bounds[i].grow(triangles[3 * i]);
+        bounds[i].grow(triangles[3 * i + 1]);
+        bounds[i].grow(triangles[3 * i + 2]);
+        mesh_bvh.bounds.grow(bounds[i]);
+    }
+    // NOTE: the kernel tests a float copy of the ray, which can pass a hair to the side of the one
+    // the (double) boxes are tested with. Right at a shared edge or vertex that is enough to
+    // land in a triangle whose box was culled, so boxes get a little slack.
+    Vec3 extent = mesh_bvh.bounds.max - mesh_bvh.bounds.min;
+    double slack = 1e-5 * std::max(extent.x, std::max(extent.y, extent.z));
+    Vec3 padding(slack, slack, slack);
+    for (int i = 0; i < count; i++) {
+        bounds[i] = AABB(bounds[i].min - padding, bounds[i].max + padding);
+    }
+    build_bvh(mesh_bvh.bvh, bounds.data(), count);
+    mesh_bvh.bounds = mesh_bvh.bvh.nodes[0].bounds;
+
+    // store the corners in leaf order, padded by the widest vector like the sphere pool
+    for (int corner = 0; corner < 3; corner++) {
+        for (int axis = 0; axis < 3; axis++) {
+            mesh_bvh.corners[corner][axis].assign(count + max_simd_width, 0.0f);
+        }
+    }
+    for (int slot = 0; slot < count; slot++) {
+        for (int corner = 0; corner < 3; corner++) {
+            const Vec3& vertex = triangles[3 * mesh_bvh.bvh.indices[slot] + corner];
+            mesh_bvh.corners[corner][0][slot] = vertex.x;
+            mesh_bvh.corners[corner][1][slot] = vertex.y;
+            mesh_bvh.corners[corner][2][slot] = vertex.z;
+        }
+    }
+    mesh_bvh.triangle_count = count;
+    mesh_bvhs.push_back(std::move(mesh_bvh));
+    return (int)mesh_bvhs.size() - 1;
+}
+
+static TriangleRay make_triangle_ray(const Ray& ray) {
+    double direction[3] = {ray.direction.x, ray.direction.y, ray.direction.z};
+    TriangleRay triangle_ray;
+    int kz = 0;
+    if (std::abs(direction[1]) > std::abs(direction[kz])) {
+        kz = 1;
+    }
+    if (std::abs(direction[2]) > std::abs(direction[kz])) {
+        kz = 2;
+    }
+    int kx = (kz + 1) % 3;
+    int ky = (kx + 1) % 3;
+    // keep the winding, so the sign of the determinant still tells the sides apart
+    if (direction[kz] < 0) {
+        std::swap(kx, ky);
+    }
+    triangle_ray.kx = kx;
+    triangle_ray.ky = ky;
+    triangle_ray.kz = kz;
+    triangle_ray.origin[0] = (float)ray.origin.x;
+    triangle_ray.origin[1] = (float)ray.origin.y;
+    triangle_ray.origin[2] = (float)ray.origin.z;
+    triangle_ray.shear_x = (float)(direction[kx] / direction[kz]);
+    triangle_ray.shear_y = (float)(direction[ky] / direction[kz]);
+    triangle_ray.shear_z = (float)(1 / direction[kz]);
+    return triangle_ray;
+}
+
+bool hit_mesh(const MeshBVH& mesh, const Ray& ray, double tmin, double& closest, Vec3& normal) {
+    TriangleRay triangle_ray = make_triangle_ray(ray);
+    TriangleArrays triangles;
+    for (int corner = 0; corner < 3; corner++) {
+        for (int axis = 0; axis < 3; axis++) {
+            triangles.corners[corner][axis] = mesh.corners[corner][axis].data();
+        }
+    }
+    int nearest = -1;
+    traverse_bvh(mesh.bvh, ray.origin, ray.direction, tmin, closest, [&](int first, int count) {
+        float t;
+        int slot = kernels.hit_triangles(triangles, first, count, triangle_ray, (float)tmin, (float)closest, t);
+        if (slot < 0) {
+            return false;
+        }
+        closest = t;
+        nearest = slot;
+        return true;
+    });
+    if (nearest < 0) {
+        return false;
+    }
+    Vec3 corners[3];
+    for (int corner = 0; corner < 3; corner++) {
+        corners[corner] = Vec3(mesh.corners[corner][0][nearest], mesh.corners[corner][1][nearest],
+                               mesh.corners[corner][2][nearest]);
+    }
+    normal = cross(corners[1] - corners[0], corners[2] - corners[0]);
+    return true;
+}
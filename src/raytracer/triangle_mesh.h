@@ -0,0 +1,33 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include <vector>
+
+#include "bvh.h"
+#include "mesh.h"
+#include "simd.h"
+
+struct Ray;
+
+// A mesh ready for ray tracing: triangles in the leaf order of the mesh's own BVH, stored SoA so
+// the kernel tests a vector of triangles at once. Built once per loaded mesh and shared by every
+// object that shows it.
+struct MeshBVH {
+    BVH bvh;
+    aligned_floats corners[3][3]; // corners[corner][axis][triangle]
+    AABB bounds;
+    int triangle_count = 0;
+};
+
+extern std::vector<MeshBVH> mesh_bvhs;
+
+// Fans every face into triangles, builds the BVH and returns the mesh's index in mesh_bvhs. Returns
+// -1 and adds nothing when no face survives the index checks: an instance of an empty mesh would
+// have empty bounds, which the scene BVH can't bin.
+int add_mesh(const Mesh& mesh);
+
+// Nearest triangle of mesh hit by ray within (tmin, closest). Lowers closest to the hit and sets
+// normal to the triangle's (not normalized) geometric normal.
+bool hit_mesh(const MeshBVH& mesh, const Ray& ray, double tmin, double& closest, Vec3& normal);
+
+#endif // !TRIANGLE_MESH_H
@@ -0,0 +1,159 @@
+#include "thread_pool.h"
+
+int hardware_thread_count() {
+    int count = (int)std::thread::hardware_concurrency();
+    return count > 0 ? count : 1;
+}
+
+ThreadPool::ThreadPool(int thread_count) {
+    resize(thread_count);
+}
+
+ThreadPool::~ThreadPool() {
+    stop_threads();
+}
+
+void ThreadPool::resize(int thread_count) {
+    if (thread_count <= 0) {
+        thread_count = hardware_thread_count();
+    }
+    if (thread_count == size()) {
+        return;
+    }
+
+    stop_threads();
+    queues.clear();
+    for (int i = 0; i < thread_count; i++) {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+    stopping = false;
+    // worker 0 is whoever calls parallel_for
+    for (int i = 1; i < thread_count; i++) {
+        threads.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+}
+
+void ThreadPool::stop_threads() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+}
+
+void ThreadPool::parallel_for(int job_count, const Job& job) {
+    if (job_count <= 0) {
+        return;
+    }
+    if (size() == 1) {
+        for (int i = 0; i < job_count; i++) {
+            job(i, 0);
+        }
+        return;
+    }
+
+    // Hand out contiguous runs so neighbouring tiles start on the same worker. Stealing takes
+    // care of the imbalance.
+    int worker_count = size();
+    for (int worker = 0; worker < worker_count; worker++) {
+        int begin = (int)((long long)job_count * worker / worker_count);
+        int end = (int)((long long)job_count * (worker + 1) / worker_count);
+        std::lock_guard<std::mutex> lock(queues[worker]->mutex);
+        for (int i = begin; i < end; i++) {
+            queues[worker]->jobs.push_back(i);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        remaining_jobs = job_count;
+        current_job = &job;
+        generation++;
+        active_workers++;
+    }
+    wake.notify_all();
+
+    run_jobs(0, job);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    active_workers--;
+    // NOTE: also wait for the other workers to leave run_jobs, otherwise a straggler could pick up
+    // jobs from the next parallel_for while still holding a pointer to this one's job.
+    done.wait(lock, [this] { return remaining_jobs == 0 && active_workers == 0; });
+    current_job = nullptr;
+}
+
+void ThreadPool::worker_loop(int worker_index) {
+    unsigned long long seen_generation = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        seen_generation = generation;
+    }
+    while (true) {
+        const Job* job = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen_generation; });
+            if (stopping) {
+                return;
+            }
+            seen_generation = generation;
+            if (!current_job) {
+                continue;
+            }
+            job = current_job;
+            active_workers++;
+        }
+
+        run_jobs(worker_index, *job);
+
+        bool finished;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            active_workers--;
+            finished = remaining_jobs == 0 && active_workers == 0;
+        }
+        if (finished) {
+            done.notify_all();
+        }
+    }
+}
+
+void ThreadPool::run_jobs(int worker_index, const Job& job) {
+    int job_index;
+    while (pop_job(worker_index, job_index)) {
+        job(job_index, worker_index);
+        if (--remaining_jobs == 0) {
+            // take the lock so the notify can't slip in between the waiter's check and its sleep
+            std::lock_guard<std::mutex> lock(mutex);
+            done.notify_all();
+        }
+    }
+}
+
+bool ThreadPool::pop_job(int worker_index, int& job_index) {
+    {
+        WorkQueue& own = *queues[worker_index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty()) {
+            job_index = own.jobs.front();
+            own.jobs.pop_front();
+            return true;
+        }
+    }
+    int worker_count = size();
+    for (int i = 1; i < worker_count; i++) {
+        WorkQueue& victim = *queues[(worker_index + i) % worker_count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            job_index = victim.jobs.back();
+            victim.jobs.pop_back();
+            return true;
+        }
+    }
+    return false;
+}